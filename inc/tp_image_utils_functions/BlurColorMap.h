@@ -1,12 +1,26 @@
 #ifndef tp_image_utils_functions_BlurColorMap_h
 #define tp_image_utils_functions_BlurColorMap_h
 
+#include "tp_image_utils_functions/BoxBlur.h"
+
 #include "tp_image_utils/ColorMapF.h"
 
 
 namespace tp_image_utils_functions
 {
-void blurColorMap(tp_image_utils::ColorMapF& colorMap, size_t radius);
+//##################################################################################################
+//! Blur a float image in place
+/*!
+\param colorMap - The image to blur.
+\param radius - The radius of the blur, 0 will leave the image unchanged.
+\param blurAlpha - True to blur the w channel as well, otherwise w will be set to 1.
+\param border - How pixels beyond the edge are treated, the default wraps so that tileable images
+stay seamless.
+*/
+void blurColorMap(tp_image_utils::ColorMapF& colorMap,
+                  size_t radius,
+                  bool blurAlpha=false,
+                  BlurBorder border=BlurBorder::Wrap);
 }
 
 #endif
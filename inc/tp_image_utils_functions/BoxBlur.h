@@ -1,7 +1,10 @@
 #pragma once
 
 #include <vector>
+#include <string>
 #include <cmath>
+#include <cstdint>
+#include <cstddef>
 #include <thread>
 #include <atomic>
 
@@ -9,11 +12,112 @@
 
 namespace tp_image_utils_functions{
 
+//##################################################################################################
+//! The CPU implementations of the box blur passes
+/*!
+Each backend is the same code compiled for a different instruction set and selected at runtime.
+FMA is not used so every backend produces exactly the same result.
+*/
+enum class BoxBlurBackend
+{
+  Auto,   //!< The best backend supported by this CPU.
+  Scalar, //!< Compiled for the baseline instruction set of the build.
+  SSE41,  //!< SSE4.1, x86 builds using GCC or Clang only.
+  AVX2,   //!< AVX2, x86 builds using GCC or Clang only.
+  AVX512  //!< AVX-512 F and BW, x86 builds using GCC or Clang only.
+};
+
+//##################################################################################################
+const char* boxBlurBackendToString(BoxBlurBackend backend);
+
+//##################################################################################################
+BoxBlurBackend boxBlurBackendFromString(const std::string& backend);
+
+//##################################################################################################
+//! Returns true if the backend is built in and supported by this CPU.
+bool boxBlurBackendSupported(BoxBlurBackend backend);
+
+//##################################################################################################
+//! The backend that will run a request, unsupported requests fall back to the next best backend.
+BoxBlurBackend resolveBoxBlurBackend(BoxBlurBackend backend=BoxBlurBackend::Auto);
+
+//##################################################################################################
+//! How the box blur passes treat pixels beyond the edge of the image
+enum class BlurBorder
+{
+  Clamp,   //!< Repeat the edge pixel.
+  Wrap,    //!< Repeat the image, this makes the result of a tileable image tileable.
+  Mirror,  //!< Reflect the image including the edge pixel, so ...cba|abc...
+  Constant //!< Pixels beyond the edge are zero.
+};
+
+//##################################################################################################
+//! How a blur was run.
+struct BoxBlurInfo
+{
+  BoxBlurBackend backend{BoxBlurBackend::Scalar}; //!< The backend that ran the passes.
+  size_t threads{0};                              //!< The number of threads that ran the passes.
+};
+
 //##################################################################################################
 std::vector<size_t> boxesForGauss(float sigma, size_t n);
 
 //##################################################################################################
+//! Approximate a Gaussian blur with three box blurs over interleaved channels
+/*!
+This is the single CPU blur engine, it is explicitly instantiated for uint8_t, uint16_t, and float
+with 1 to 4 channels so a single channel mask only touches one byte per pixel. Borders are
+handled inside the passes so none of the modes require a padded copy of the image.
+
+Float data keeps float running sums. Integer data keeps exact integer running sums and each pass
+rounds to the nearest value, 16 bit data requires box radii below 32768.
+
+\param scl - The w*h*Channels values to blur, this will hold the result.
+\param aux - Scratch space of w*h*Channels values.
+\param w - The width of the image in pixels.
+\param h - The height of the image in pixels.
+\param r - The radius of the Gaussian that the boxes approximate.
+\param border - How pixels beyond the edge of the image are treated.
+\param backend - The backend to use, see resolveBoxBlurBackend().
+\param maxThreads - The maximum number of threads to use, 0 will use all available threads.
+\return The backend and number of threads used.
+*/
+template<typename T, size_t Channels>
+BoxBlurInfo gaussBlurBoxes(T* scl,
+                           T* aux,
+                           size_t w,
+                           size_t h,
+                           size_t r,
+                           BlurBorder border=BlurBorder::Clamp,
+                           BoxBlurBackend backend=BoxBlurBackend::Auto,
+                           size_t maxThreads=0);
+
+//##################################################################################################
+//! A true Gaussian blur using the Young-van Vliet recursive filter
+/*!
+The cost per pixel does not depend on sigma and sigma does not need to be a whole number. Pixels
+beyond the edge of the image are clamped to the edge pixel using the Triggs-Sdika boundary
+conditions. This uses the same types, channels, and backends as gaussBlurBoxes(), the filter runs
+in float and integer data is rounded to the nearest value.
+
+\param data - The w*h*Channels values to blur, this will hold the result.
+\param w - The width of the image in pixels.
+\param h - The height of the image in pixels.
+\param sigma - The standard deviation of the Gaussian, values below 0.5 leave the data unchanged.
+\param backend - The backend to use, see resolveBoxBlurBackend().
+\param maxThreads - The maximum number of threads to use, 0 will use all available threads.
+\return The backend and number of threads used.
+*/
+template<typename T, size_t Channels>
+BoxBlurInfo gaussBlurRecursive(T* data,
+                               size_t w,
+                               size_t h,
+                               float sigma,
+                               BoxBlurBackend backend=BoxBlurBackend::Auto,
+                               size_t maxThreads=0);
+
+//##################################################################################################
+//! Blur 3 channel float data, this is gaussBlurBoxes<float, 3>().
 void gaussBlur_4_cpu(float* scl, float* aux, size_t w, size_t h, size_t r);
 
 }
-
@@ -0,0 +1,84 @@
+#ifndef tp_image_utils_functions_ComponentTree_h
+#define tp_image_utils_functions_ComponentTree_h
+
+#include "tp_image_utils_functions/DeNoise.h"
+
+#include "tp_image_utils/ByteMap.h"
+
+#include <functional>
+
+namespace tp_image_utils_functions
+{
+
+//##################################################################################################
+//! The level sets that a ComponentTree is built from
+enum class ComponentTreeType
+{
+  MaxTree, //!< Nodes are the connected regions of pixels >= a level, leaves are bright peaks.
+  MinTree  //!< Nodes are the connected regions of pixels <= a level, leaves are dark pits.
+};
+
+//##################################################################################################
+//! A max-tree or min-tree of a gray image
+/*!
+Each node is a connected region of the pixels at or beyond its level, its parent is the region
+that contains it at the next level towards the background. The tree is built once and can then be
+filtered by area or any other node attribute without labeling the image again, each filter takes
+time proportional to the number of pixels.
+
+For a mask with only solid and space values a MinTree with solid<space, or a MaxTree with
+solid>space, has a node for each solid region so areaFilter(minSize) gives the same result as
+deNoise(src, minSize, addCorners, solid, space) for any minSize. The only difference is that the
+root is always kept, so a mask that is entirely solid is not removed.
+
+The tree is built with Berger's union-find algorithm after a counting sort of the pixels, it uses
+four ints per pixel while building and one int per pixel once built.
+*/
+struct ComponentTree
+{
+  //! The nodes, value is the level of the node, count is the number of pixels in the node and its
+  //! descendants and the bounding box covers the same pixels. The root is node 0.
+  std::vector<ByteRegion> nodes;
+
+  //! The parent index of each node, parents always come before their children, the root is -1.
+  std::vector<int> parents;
+
+  //! The index of the node that each pixel belongs to at its own level.
+  std::vector<int> map;
+
+  ComponentTreeType type{ComponentTreeType::MaxTree};
+  size_t w{0};
+  size_t h{0};
+
+  //################################################################################################
+  //! Build the tree for an image
+  /*!
+  \param src The image to build the tree for.
+  \param type Build a MaxTree for area openings or a MinTree for area closings.
+  \param addCorners Set this true if regions should be joined by corners as well as edges.
+  */
+  ComponentTree(const tp_image_utils::ByteMap& src, ComponentTreeType type, bool addCorners);
+
+  //################################################################################################
+  //! Remove the nodes that fail a test
+  /*!
+  The pixels of each removed node take the level of their closest kept ancestor, the root is
+  always kept. This is the direct rule, it keeps kept nodes unchanged even if the test is not
+  increasing.
+
+  \param keep Returns true for nodes that should be kept.
+  \return The filtered image.
+  */
+  tp_image_utils::ByteMap attributeFilter(const std::function<bool(const ByteRegion&)>& keep)const;
+
+  //################################################################################################
+  //! Remove the nodes with less than minArea pixels
+  /*!
+  This is an area opening for a MaxTree and an area closing for a MinTree.
+  */
+  tp_image_utils::ByteMap areaFilter(size_t minArea)const;
+};
+
+}
+
+#endif
@@ -7,11 +7,13 @@
 
 #include <string>
 #include <vector>
+#include <memory>
 
 namespace tp_image_utils
 {
 class ColorMap;
 class ColorMapF;
+class ByteMap;
 }
 
 namespace tp_image_utils_functions
@@ -53,8 +55,16 @@ public:
   void loadString(const std::string& text);
 
   //################################################################################################
+  //! Apply the matrix, see convolutionMatrix()
+  /*!
+  Large matrices are applied using FFTs, the spectrum of the matrix is cached so repeated calls only
+  transform the image.
+  */
   [[nodiscard]]tp_image_utils::ColorMap convolve(const tp_image_utils::ColorMap& src)const;
 
+  //################################################################################################
+  [[nodiscard]]tp_image_utils::ByteMap convolve(const tp_image_utils::ByteMap& src)const;
+
   //################################################################################################
   //! Create a 3x3 identity matrix
   void makeIdentity();
@@ -68,16 +78,64 @@ public:
   //################################################################################################
   void divideBySize();
 
+  //################################################################################################
+  //! Returns true if the matrix is rank 1 and can be applied as a horizontal then vertical pass.
+  [[nodiscard]]bool isSeparable()const;
+
+  //################################################################################################
+  //! The horizontal kernel of a separable matrix, matrix(x,y) = columnData()[y]*rowData()[x].
+  const std::vector<double>& rowData()const;
+
+  //################################################################################################
+  //! The vertical kernel of a separable matrix, matrix(x,y) = columnData()[y]*rowData()[x].
+  const std::vector<double>& columnData()const;
+
 private:
+  //################################################################################################
+  //! Update the separable kernels and discard cached spectra after the matrix changes.
+  void matrixChanged();
+
+  struct FFTCache;
+
   std::vector<double> m_matrixData;
   size_t m_width{0};
   size_t m_height{0};
+
+  bool m_separable{false};
+  std::vector<double> m_rowData;
+  std::vector<double> m_columnData;
+
+  //! Kernel spectrum for the FFT path, shared by copies of the same matrix.
+  std::shared_ptr<FFTCache> m_fftCache;
 };
 
+//##################################################################################################
+//! Split a matrix into a horizontal and a vertical kernel
+/*!
+A rank 1 matrix can be applied as a horizontal pass followed by a vertical pass, reducing the work
+per pixel from width*height to width+height.
+
+\param matrixData - The matrix organised as rows.
+\param width - The number of columns in the matrix.
+\param height - The number of rows in the matrix.
+\param row - Set to the width elements of the horizontal kernel.
+\param column - Set to the height elements of the vertical kernel.
+
+\return true if the matrix is separable, matrix(x,y) = column[y]*row[x].
+*/
+bool separateMatrix(const std::vector<double>& matrixData,
+                    size_t width,
+                    size_t height,
+                    std::vector<double>& row,
+                    std::vector<double>& column);
+
 //##################################################################################################
 //! Apply a convolution matrix to the image
 /*!
-Apply a convolution matrix to the image and return the result.
+Apply a convolution matrix to the image and return the result. Separable matrices are applied as a
+horizontal pass followed by a vertical pass. The weights are converted to fixed point and results are
+truncated and clamped to 0-255, the alpha channel is set to 255. Non separable matrices of 15x15 and
+larger are applied using FFTs of overlapping tiles.
 
 \note the width and height should be odd numbers larger than one.
 
@@ -93,6 +151,32 @@ tp_image_utils::ColorMap convolutionMatrix(const tp_image_utils::ColorMap& src,
                                            size_t width,
                                            size_t height);
 
+//##################################################################################################
+//! Apply a convolution matrix to a single channel image, see the ColorMap overload.
+tp_image_utils::ByteMap convolutionMatrix(const tp_image_utils::ByteMap& src,
+                                          const std::vector<double>& matrixData,
+                                          size_t width,
+                                          size_t height);
+
+//##################################################################################################
+//! Apply several convolution matrices to the same image in one pass
+/*!
+Each band of source rows is read once and used by every matrix, which is faster than calling
+ConvolutionMatrix::convolve() for each matrix when the source does not fit in cache.
+
+\param src - The source image.
+\param matrices - The matrices to apply.
+
+\return One image per matrix in the same order, each the same as ConvolutionMatrix::convolve().
+*/
+std::vector<tp_image_utils::ColorMap> convolutionMatrices(const tp_image_utils::ColorMap& src,
+                                                          const std::vector<ConvolutionMatrix>& matrices);
+
+//##################################################################################################
+//! Apply several convolution matrices to the same single channel image in one pass.
+std::vector<tp_image_utils::ByteMap> convolutionMatrices(const tp_image_utils::ByteMap& src,
+                                                         const std::vector<ConvolutionMatrix>& matrices);
+
 //##################################################################################################
 tp_image_utils::ColorMapF convolvePadded(const tp_image_utils::ColorMapF& src,
                                          const std::vector<float>& matrixData,
@@ -108,10 +192,63 @@ void                   gaussBlur(glm::vec3 *start, //initial buffer to get blur
                                  size_t radius);
 
 //##################################################################################################
-tp_image_utils::ColorMap gaussBlur(const tp_image_utils::ColorMap& source, size_t radius);
+//! The algorithm used to approximate a Gaussian blur
+enum class GaussBlurMode
+{
+  Boxes,    //!< Three box blurs, fast but sigma is rounded to a whole number of pixels.
+  Recursive //!< Young-van Vliet recursive filter, closer to a true Gaussian and accepts any sigma.
+};
+
+//##################################################################################################
+//! Blur an 8 bit image using integer running sums over the RGBA bytes
+/*!
+Each of the box passes rounds to the nearest value.
+
+\param source - The image to blur.
+\param radius - The radius of the blur.
+\param blurAlpha - True to blur the alpha channel as well, otherwise alpha will be set to 255.
+\return The blurred image.
+*/
+tp_image_utils::ColorMap gaussBlur(const tp_image_utils::ColorMap& source, size_t radius, bool blurAlpha=false);
+
+//##################################################################################################
+//! Blur the vec4 pixels of a float image using a single scratch buffer
+/*!
+\param source - The image to blur.
+\param radius - The radius of the blur.
+\param blurAlpha - True to blur the w channel as well, otherwise w will be set to 1.
+\return The blurred image.
+*/
+tp_image_utils::ColorMapF gaussBlur(const tp_image_utils::ColorMapF& source, size_t radius, bool blurAlpha=false);
+
+//##################################################################################################
+//! Blur a single channel image, each pixel is kept as a single byte throughout the blur.
+tp_image_utils::ByteMap gaussBlur(const tp_image_utils::ByteMap& source, size_t radius);
+
+//##################################################################################################
+//! Blur an 8 bit image using the selected mode
+/*!
+\param source - The image to blur.
+\param sigma - The standard deviation of the blur in pixels.
+\param mode - The algorithm used for the blur.
+\param blurAlpha - True to blur the alpha channel as well, otherwise alpha will be set to 255.
+\return The blurred image.
+*/
+tp_image_utils::ColorMap gaussBlur(const tp_image_utils::ColorMap& source,
+                                   float sigma,
+                                   GaussBlurMode mode,
+                                   bool blurAlpha=false);
+
+//##################################################################################################
+//! Blur a float image using the selected mode, w will be set to 1 unless blurAlpha is true.
+tp_image_utils::ColorMapF gaussBlur(const tp_image_utils::ColorMapF& source,
+                                    float sigma,
+                                    GaussBlurMode mode,
+                                    bool blurAlpha=false);
 
 //##################################################################################################
-tp_image_utils::ColorMapF gaussBlur(const tp_image_utils::ColorMapF& source, size_t radius);
+//! Blur a single channel image using the selected mode.
+tp_image_utils::ByteMap gaussBlur(const tp_image_utils::ByteMap& source, float sigma, GaussBlurMode mode);
 
 //##################################################################################################
 tp_image_utils::ColorMapF blur3(const tp_image_utils::ColorMapF& src);
@@ -20,31 +20,93 @@ struct ByteRegion
   size_t maxY{0}; //!< The max y coordinate of this region calculated by calculateBoundingBoxes()
 };
 
+//##################################################################################################
+//! Shape statistics of a region, calculated while labeling if requested
+/*!
+The moments are the raw moments of the pixel coordinates, mpq is the sum of x^p * y^q over the
+pixels in the region so m00 is the number of pixels.
+*/
+struct ByteRegionStats
+{
+  double m00{0.0};
+  double m10{0.0};
+  double m01{0.0};
+  double m20{0.0};
+  double m11{0.0};
+  double m02{0.0};
+
+  //! The number of pixel edges between the region and other regions or the edge of the image.
+  /*!
+  This overestimates the length of smooth diagonal boundaries, multiply by pi/4 for an estimate.
+  */
+  size_t perimeter{0};
+
+  //################################################################################################
+  double centroidX()const;
+
+  //################################################################################################
+  double centroidY()const;
+
+  //################################################################################################
+  //! The variance of the x coordinates.
+  double mu20()const;
+
+  //################################################################################################
+  //! The covariance of the x and y coordinates.
+  double mu11()const;
+
+  //################################################################################################
+  //! The variance of the y coordinates.
+  double mu02()const;
+
+  //################################################################################################
+  //! The angle of the major axis in radians measured from the x axis towards the y axis.
+  double orientation()const;
+
+  //################################################################################################
+  //! The eccentricity of the ellipse with the same second moments, 0 for a circle up to 1 for a line.
+  double eccentricity()const;
+};
+
 //##################################################################################################
 struct ByteRegions
 {
   //! The details for each region found
   std::vector<ByteRegion> regions;
 
-  //! The region indexes for each pixel in the image
+  //! The region index of each pixel, numbered in the raster order of the first pixel of each region
   std::vector<int> map;
 
+  //! The shape statistics for each region, empty unless requested
+  std::vector<ByteRegionStats> stats;
+
   size_t w{0};
   size_t h{0};
 
   //################################################################################################
   //! Separate the regions of an image
   /*!
-  Split a gray image into regions.
+  Split a gray image into regions of connected pixels with the same value. This uses a two pass
+  union-find labeling, apart from the output it uses one int per pixel.
+
+  The image is labeled in horizontal strips on several threads and the strips are then joined. The
+  regions and their indexes are the same for any number of threads.
+
   \param src The image to split.
   \param addCorners Set this true if regions should be joined by corners as well as edges.
+  \param calculateStats Set this true to fill the bounding boxes and stats while labeling.
+  \param maxThreads The maximum number of threads to use, 0 will use all available threads.
   */
-  ByteRegions(const tp_image_utils::ByteMap& src, bool addCorners);
+  ByteRegions(const tp_image_utils::ByteMap& src,
+              bool addCorners,
+              bool calculateStats=false,
+              size_t maxThreads=0);
 
   //################################################################################################
   //! Calculate the region bounding boxes
   /*!
-  Call this if you need to use use ByteRegion min and max coordinates.
+  Call this if you need to use use ByteRegion min and max coordinates, this is not required if the
+  regions were created with calculateStats set.
   */
   void calculateBoundingBoxes();
 };
@@ -56,7 +118,8 @@ tp_image_utils::ByteMap deNoise(const tp_image_utils::ByteMap& src,
                                 size_t minSize,
                                 bool addCorners,
                                 uint8_t solid=0,
-                                uint8_t space=255);
+                                uint8_t space=255,
+                                size_t maxThreads=0);
 
 //##################################################################################################
 tp_image_utils::ByteMap deNoiseBlobs(const tp_image_utils::ByteMap& src,
@@ -68,7 +131,8 @@ tp_image_utils::ByteMap deNoiseBlobs(const tp_image_utils::ByteMap& src,
                                      size_t maxSize,
                                      bool addCorners,
                                      uint8_t solid=0,
-                                     uint8_t space=255);
+                                     uint8_t space=255,
+                                     size_t maxThreads=0);
 
 //##################################################################################################
 tp_image_utils::ByteMap deNoiseStripes(const tp_image_utils::ByteMap& src, size_t minSize, uint8_t solid=0, uint8_t space=255);
@@ -1,28 +1,93 @@
 #pragma once
 
+#include "tp_image_utils_functions/BoxBlur.h"
+
 #include <string>
 #include <memory>
+#include <vector>
 
 //compilation controlled by define option:
 //#define USE_OPENCL
 
+namespace tp_image_utils
+{
+class ColorMap;
+class ColorMapF;
+}
+
 namespace tp_image_utils_functions
 {
 
 //##################################################################################################
+//! Gaussian blur using OpenCL if available with a CPU fallback
+/*!
+The engine keeps its scratch buffers between calls, they grow to fit the largest frame seen so
+blurring a stream of frames of the same size does not allocate. A single engine should not be
+used from several threads at the same time.
+
+Without OpenCL the blur runs on the best CPU backend for the host, see BoxBlurBackend.
+*/
 class GaussBlurEngine{
 public:
   GaussBlurEngine();
   ~GaussBlurEngine();
 
+  //################################################################################################
+  //! Blur w*h interleaved RGB float pixels in place.
   void doBlur(float* scl, size_t w, size_t h, size_t r);
 
+  //################################################################################################
+  //! Blur the RGB channels into result, on the CPU this matches gaussBlur(source, r).
+  /*!
+  \param source - The image to blur.
+  \param result - Resized to match source if required, the alpha channel will be set to 255.
+  \param r - The radius of the blur.
+  */
+  void doBlur(const tp_image_utils::ColorMap& source, tp_image_utils::ColorMap& result, size_t r);
+
+  //################################################################################################
+  //! Blur the xyz channels of source into result, w will be set to 1.
+  void doBlur(const tp_image_utils::ColorMapF& source, tp_image_utils::ColorMapF& result, size_t r);
+
+  //################################################################################################
+  //! Grow the scratch buffers to fit a w*h frame so that the first blur does not allocate.
+  void reserve(size_t w, size_t h);
+
+  //################################################################################################
+  //! Free the scratch buffers, they will be allocated again by the next blur.
+  void releaseMemory();
+
+  //################################################################################################
+  //! Override the CPU backend, the default is BoxBlurBackend::Auto.
+  void setBackend(BoxBlurBackend backend);
+
+  //################################################################################################
+  BoxBlurBackend backend()const;
+
+  //################################################################################################
+  //! The maximum number of threads the CPU backends will use, 0 will use all available threads.
+  void setMaxThreads(size_t maxThreads);
+
+  //################################################################################################
+  size_t maxThreads()const;
+
   std::string getErrorString();
+
+  //################################################################################################
+  //! Describes the device used, or the CPU backend and thread count used by the last blur.
   std::string getInfoString();
 
 private:
   class GaussBlurAccelerator;
   std::unique_ptr<GaussBlurAccelerator> oclGaussBlur;
+
+  std::vector<float> m_pixels;
+  std::vector<float> m_aux;
+
+  BoxBlurBackend m_backend{BoxBlurBackend::Auto};
+  size_t m_maxThreads{0};
+  BoxBlurInfo m_cpuInfo;
+  bool m_cpuUsed{false};
 };
 
 }
@@ -0,0 +1,133 @@
+#ifndef tp_image_utils_functions_RunLengthMask_h
+#define tp_image_utils_functions_RunLengthMask_h
+
+#include "tp_image_utils_functions/DeNoise.h"
+
+#include "tp_image_utils/ByteMap.h"
+
+namespace tp_image_utils_functions
+{
+
+//##################################################################################################
+//! A binary mask stored as horizontal runs of solid pixels
+/*!
+Only the solid pixels are stored, as 8 bytes per run plus 8 bytes per row, so masks that are mostly
+space take a fraction of the memory of a ByteMap. The runs of each row are sorted, do not overlap,
+and do not touch.
+*/
+class RunLengthMask
+{
+public:
+  //################################################################################################
+  //! The solid pixels from x0 up to but not including x1.
+  struct Run
+  {
+    uint32_t x0{0};
+    uint32_t x1{0};
+  };
+
+  //################################################################################################
+  RunLengthMask();
+
+  //################################################################################################
+  //! Construct an empty mask, add runs with appendRun().
+  RunLengthMask(size_t width, size_t height);
+
+  //################################################################################################
+  //! Construct a mask from the pixels of src that equal solid.
+  explicit RunLengthMask(const tp_image_utils::ByteMap& src, uint8_t solid=0);
+
+  //################################################################################################
+  tp_image_utils::ByteMap toByteMap(uint8_t solid=0, uint8_t space=255)const;
+
+  //################################################################################################
+  [[nodiscard]]size_t width()const;
+
+  //################################################################################################
+  [[nodiscard]]size_t height()const;
+
+  //################################################################################################
+  //! The total number of runs in the mask.
+  [[nodiscard]]size_t runCount()const;
+
+  //################################################################################################
+  //! The number of solid pixels in the mask.
+  [[nodiscard]]size_t pixelCount()const;
+
+  //################################################################################################
+  //! The first run of row y.
+  const Run* rowBegin(size_t y)const;
+
+  //################################################################################################
+  //! One past the last run of row y.
+  const Run* rowEnd(size_t y)const;
+
+  //################################################################################################
+  //! Add solid pixels x0 up to x1 on row y
+  /*!
+  Runs must be added in raster order, a run that touches the previous run on the same row is joined
+  to it. Pixels outside the mask are ignored.
+  */
+  void appendRun(size_t y, size_t x0, size_t x1);
+
+  //################################################################################################
+  //! Find the bounding box of the solid pixels, returns false if there are none.
+  bool boundingBox(size_t& minX, size_t& minY, size_t& maxX, size_t& maxY)const;
+
+  //################################################################################################
+  //! Returns true if any pixel in the rectangle is solid.
+  [[nodiscard]]bool anySolid(size_t x, size_t y, size_t width, size_t height)const;
+
+  //################################################################################################
+  //! Swap rows and columns, the cost depends on the number of runs that start and end.
+  [[nodiscard]]RunLengthMask transposed()const;
+
+private:
+  size_t m_width{0};
+  size_t m_height{0};
+
+  std::vector<Run> m_runs;
+
+  //! The index of the first run of each row up to m_openRow, later rows are still empty.
+  std::vector<size_t> m_rowStarts;
+  size_t m_openRow{0};
+};
+
+//##################################################################################################
+//! The connected regions of the solid pixels of a RunLengthMask
+/*!
+This is the run length equivalent of ByteRegions, it only labels the solid pixels and the time
+taken is proportional to the number of runs rather than the number of pixels. Regions are numbered
+in the raster order of their first pixel.
+*/
+struct RunLengthRegions
+{
+  //! The count and bounding box of each region, value is not used.
+  std::vector<ByteRegion> regions;
+
+  //! The region index of each run of the mask in raster order.
+  std::vector<int> runRegions;
+
+  //################################################################################################
+  /*!
+  \param mask The mask to split.
+  \param addCorners Set this true if regions should be joined by corners as well as edges.
+  */
+  RunLengthRegions(const RunLengthMask& mask, bool addCorners);
+};
+
+//##################################################################################################
+//! Remove solid regions smaller than minSize, the same as deNoise() on the equivalent ByteMap.
+RunLengthMask deNoise(const RunLengthMask& src, size_t minSize, bool addCorners);
+
+//##################################################################################################
+//! Remove short stripes, the same as deNoiseStripes() on the equivalent ByteMap.
+/*!
+Columns are filtered on the transposed mask then rows are filtered, runs shorter than minSize are
+removed unless they touch the edge of the image.
+*/
+RunLengthMask deNoiseStripes(const RunLengthMask& src, size_t minSize);
+
+}
+
+#endif
@@ -5,9 +5,30 @@
 
 #include "tp_image_utils/ByteMap.h"
 
+#include <functional>
+
+namespace tp_image_utils
+{
+class ColorMapF;
+}
+
 namespace tp_image_utils_functions
 {
 
+//##################################################################################################
+//! The algorithm used to calculate distance fields
+enum class DistanceFieldMethod
+{
+  EDT,     //!< Exact Euclidean distance transform, linear in the number of pixels.
+  QuadTree //!< Closest point queries against a quad tree, slower but kept for comparison.
+};
+
+//##################################################################################################
+const char* distanceFieldMethodToString(DistanceFieldMethod method);
+
+//##################################################################################################
+DistanceFieldMethod distanceFieldMethodFromString(const std::string& method);
+
 //##################################################################################################
 //! Generate a signed distance field image
 /*!
@@ -16,9 +37,14 @@ green, and blue channels each set to the same SDF value. The alpha channel will
 
 \param src - The source image only the red channel will be used, values >0 will be cosidered white.
 \param radius - This controls the radius at which the generated value will saturate.
+\param method - The algorithm used to calculate the distances.
+\param maxThreads - The maximum number of threads used by the EDT, 0 will use all available threads.
 \return The generated signed distance field.
 */
-tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src, int radius);
+tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src,
+                                             int radius,
+                                             DistanceFieldMethod method=DistanceFieldMethod::EDT,
+                                             size_t maxThreads=0);
 
 //##################################################################################################
 //! Generate a signed distance field image
@@ -30,18 +56,196 @@ green, and blue channels each set to the same SDF value. The alpha channel will
 \param radius - This controls the radius at which the generated value will saturate.
 \param width - The width of the destination image, may be less than the source width.
 \param height - The height of the destination image, may be less than the source height.
+\param method - The algorithm used to calculate the distances.
+\param maxThreads - The maximum number of threads used by the EDT, 0 will use all available threads.
 \return The generated signed distance field.
 */
-tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src, int radius, int width, int height);
+tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src,
+                                             int radius,
+                                             int width,
+                                             int height,
+                                             DistanceFieldMethod method=DistanceFieldMethod::EDT,
+                                             size_t maxThreads=0);
+
+//##################################################################################################
+tp_image_utils::ByteMap signedDistanceField(const tp_image_utils::ByteMap& src,
+                                            int radius,
+                                            DistanceFieldMethod method=DistanceFieldMethod::EDT,
+                                            size_t maxThreads=0);
+
+//##################################################################################################
+tp_image_utils::ByteMap distanceField(const tp_image_utils::ByteMap& src,
+                                      int radius,
+                                      DistanceFieldMethod method=DistanceFieldMethod::EDT,
+                                      size_t maxThreads=0);
+
+//##################################################################################################
+tp_image_utils::ByteMap signedDistanceField(const tp_image_utils::ByteMap& src,
+                                            int radius,
+                                            int width,
+                                            int height,
+                                            DistanceFieldMethod method=DistanceFieldMethod::EDT,
+                                            size_t maxThreads=0);
+
+//##################################################################################################
+//! Calculate raw signed distances
+/*!
+White pixels get the positive distance in pixels to the closest black pixel and black pixels get
+the negative distance to the closest white pixel. The distances are not clamped to a radius, if
+there are no pixels of the opposite color the distance will be +/-inf.
+
+\param src - The source image, values >0 will be cosidered white.
+\param dst - Buffer of src.width()*src.height() floats that the distances will be written to.
+\param maxThreads - The maximum number of threads to use, 0 will use all available threads.
+*/
+void signedDistanceField(const tp_image_utils::ByteMap& src, float* dst, size_t maxThreads=0);
+
+//##################################################################################################
+//! Calculate raw signed distances using only the red channel, values >0 will be cosidered white.
+void signedDistanceField(const tp_image_utils::ColorMap& src, float* dst, size_t maxThreads=0);
+
+//##################################################################################################
+//! Calculate raw signed distances, dst will be resized to match src.
+void signedDistanceField(const tp_image_utils::ByteMap& src, std::vector<float>& dst, size_t maxThreads=0);
+
+//##################################################################################################
+//! Calculate raw signed distances into a single channel of dst
+/*!
+\param src - The source image, values >0 will be cosidered white.
+\param dst - Must be the same size as src, only the selected channel will be modified.
+\param channel - The channel to write the distances to 0=x, 1=y, 2=z, 3=w.
+\param maxThreads - The maximum number of threads to use, 0 will use all available threads.
+*/
+void signedDistanceField(const tp_image_utils::ByteMap& src,
+                         tp_image_utils::ColorMapF& dst,
+                         size_t channel,
+                         size_t maxThreads=0);
 
 //##################################################################################################
-tp_image_utils::ByteMap signedDistanceField(const tp_image_utils::ByteMap& src, int radius);
+//! Convert raw signed distances into an 8 bit signed distance field
+/*!
+This produces the same output as signedDistanceField(src, radius) from the output of
+signedDistanceField(src, dst), so a single calculation can produce both.
+
+\param sdf - The width*height raw signed distances.
+\param radius - This controls the radius at which the generated value will saturate.
+*/
+tp_image_utils::ByteMap signedDistanceFieldToByteMap(const float* sdf, size_t width, size_t height, int radius);
 
 //##################################################################################################
-tp_image_utils::ByteMap distanceField(const tp_image_utils::ByteMap& src, int radius);
+//! Convert raw signed distances into a grey 8 bit signed distance field image
+tp_image_utils::ColorMap signedDistanceFieldToColorMap(const float* sdf, size_t width, size_t height, int radius);
 
 //##################################################################################################
-tp_image_utils::ByteMap signedDistanceField(const tp_image_utils::ByteMap& src, int radius, int width, int height);
+//! Generate a pyramid of signed distance fields
+/*!
+The full resolution distances are calculated once and each following level is generated by
+averaging 2x2 blocks of the previous level, odd sizes are rounded up. All levels use the same
+radius measured in source pixels so that edges keep the same value at every level, like the mip
+chain of a distance field texture.
+
+\param src - The source image, values >0 will be cosidered white.
+\param radius - This controls the radius at which the generated value will saturate.
+\param levels - The number of levels to generate including the full resolution level.
+\param maxThreads - The maximum number of threads to use, 0 will use all available threads.
+\return The levels, the first is the same as signedDistanceField(src, radius).
+*/
+std::vector<tp_image_utils::ByteMap> signedDistanceFieldPyramid(const tp_image_utils::ByteMap& src,
+                                                                int radius,
+                                                                size_t levels,
+                                                                size_t maxThreads=0);
+
+//##################################################################################################
+//! Generate a pyramid of grey signed distance field images using only the red channel.
+std::vector<tp_image_utils::ColorMap> signedDistanceFieldPyramid(const tp_image_utils::ColorMap& src,
+                                                                 int radius,
+                                                                 size_t levels,
+                                                                 size_t maxThreads=0);
+
+//##################################################################################################
+//! Generate a signed distance field tile by tile
+/*!
+This produces the same result as signedDistanceField(src, radius) without holding the whole mask or
+output in memory. Each tile is calculated from the mask pixels within radius of the tile, so peak
+memory depends on the tile size and radius rather than the image size.
+
+\param width - The width of the whole mask.
+\param height - The height of the whole mask.
+\param radius - This controls the radius at which the generated value will saturate.
+\param tileSize - The width and height of the output tiles, tiles on the right and bottom edges may
+be smaller.
+\param readMask - Called with (x, y, region) to read the mask pixels starting at (x, y) into region,
+region is already sized to the pixels required. Values >0 will be cosidered white.
+\param writeTile - Called with (x, y, tile) for each output tile in turn.
+\param maxThreads - The maximum number of threads used for each tile, 0 will use all available threads.
+*/
+void signedDistanceFieldTiled(size_t width,
+                              size_t height,
+                              int radius,
+                              size_t tileSize,
+                              const std::function<void(size_t, size_t, tp_image_utils::ByteMap&)>& readMask,
+                              const std::function<void(size_t, size_t, const tp_image_utils::ByteMap&)>& writeTile,
+                              size_t maxThreads=0);
+
+//##################################################################################################
+//! Generate a signed distance field tile by tile from a mask that is already in memory.
+void signedDistanceFieldTiled(const tp_image_utils::ByteMap& src,
+                              int radius,
+                              size_t tileSize,
+                              const std::function<void(size_t, size_t, const tp_image_utils::ByteMap&)>& writeTile,
+                              size_t maxThreads=0);
+
+//##################################################################################################
+//! A distance field that can be updated after local edits to the mask
+/*!
+This holds the output of distanceField() or signedDistanceField() for a mask. Because the output
+saturates at the radius an edit to the mask can only change pixels within radius of the edit, so
+update() only recalculates that neighbourhood using the mask within a further radius as context.
+The result is identical to recalculating the whole field.
+*/
+class IncrementalDistanceField
+{
+public:
+  //################################################################################################
+  //! Calculate the initial distance field
+  /*!
+  \param mask - The source mask, values >0 will be cosidered white.
+  \param radius - This controls the radius at which the generated value will saturate.
+  \param signedField - True to match signedDistanceField() false to match distanceField().
+  \param maxThreads - The maximum number of threads to use, 0 will use all available threads.
+  */
+  IncrementalDistanceField(const tp_image_utils::ByteMap& mask,
+                           int radius,
+                           bool signedField=false,
+                           size_t maxThreads=0);
+
+  //################################################################################################
+  //! The current distance field, the same size as the mask.
+  const tp_image_utils::ByteMap& field()const;
+
+  //################################################################################################
+  //! Update the field after pixels in a rectangle of the mask have changed
+  /*!
+  Only pixels of the field within radius of the rectangle will be modified.
+
+  \param mask - The modified mask, this must be the same size as the original.
+  \param x - The left of the modified rectangle.
+  \param y - The top of the modified rectangle.
+  \param width - The width of the modified rectangle.
+  \param height - The height of the modified rectangle.
+  */
+  void update(const tp_image_utils::ByteMap& mask, size_t x, size_t y, size_t width, size_t height);
+
+  //################################################################################################
+  //! Update the field after the listed (x, y) pixels of the mask have changed.
+  void update(const tp_image_utils::ByteMap& mask, const std::vector<std::pair<size_t, size_t>>& changedPixels);
+
+private:
+  tp_image_utils::ByteMap m_field;
+  int m_radius;
+  bool m_signedField;
+  size_t m_maxThreads;
+};
 
 }
 
@@ -1,9 +1,12 @@
 #include "tp_image_utils_functions/BoxBlur.h"
 
-#include "tp_utils/Parallel.h"
+#include "PrivateUtils.h"
 
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
 #include <thread>
 #include <atomic>
 #include <sstream>
@@ -19,137 +22,736 @@
 namespace
 {
 
-using float3 = glm::vec3;
+//##################################################################################################
+//! Running sum types for each storage type.
+template<typename T>
+struct BoxSum_lt;
 
 //##################################################################################################
-inline float3 getf3(float* v, size_t index = 0)
+template<>
+struct BoxSum_lt<float>
 {
-  index *= 3;
-  return { v[index], v[index+1], v[index+2] };
-}
+  using Acc = float;
+  using Scale = float;
+
+  //################################################################################################
+  static Scale scale(size_t r)
+  {
+    return 1.0f / float(r + r + 1);
+  }
+
+  //################################################################################################
+  static float store(Acc val, Scale iarr)
+  {
+    return val * iarr;
+  }
+
+  //################################################################################################
+  static float fromFloat(float val)
+  {
+    return val;
+  }
+};
+
+//##################################################################################################
+//! Sums of up to 2^24 are exact in a float and the box width is odd so a sum never lands exactly
+//! half way between two values, this rounds correctly for box radii below 4096.
+template<>
+struct BoxSum_lt<uint8_t>
+{
+  using Acc = uint32_t;
+  using Scale = float;
+
+  //################################################################################################
+  static Scale scale(size_t r)
+  {
+    return 1.0f / float(r + r + 1);
+  }
+
+  //################################################################################################
+  static uint8_t store(Acc val, Scale iarr)
+  {
+    return uint8_t(float(val) * iarr + 0.5f);
+  }
+
+  //################################################################################################
+  static uint8_t fromFloat(float val)
+  {
+    return uint8_t(std::min(std::max(val, 0.0f), 255.0f) + 0.5f);
+  }
+};
 
 //##################################################################################################
-inline void setf3(float* dst, const float3& v, size_t index = 0)
+template<>
+struct BoxSum_lt<uint16_t>
 {
-  index *= 3;
-  dst[index+0] = v.x;
-  dst[index+1] = v.y;
-  dst[index+2] = v.z;
+  using Acc = uint32_t;
+  using Scale = double;
+
+  //################################################################################################
+  static Scale scale(size_t r)
+  {
+    return 1.0 / double(r + r + 1);
+  }
+
+  //################################################################################################
+  static uint16_t store(Acc val, Scale iarr)
+  {
+    return uint16_t(double(val) * iarr + 0.5);
+  }
+
+  //################################################################################################
+  static uint16_t fromFloat(float val)
+  {
+    return uint16_t(std::min(std::max(val, 0.0f), 65535.0f) + 0.5f);
+  }
+};
+
+//##################################################################################################
+//! The kernels are forced inline into each backend so that they are compiled for its target.
+#if defined(__GNUC__)
+#  define TP_BOX_BLUR_INLINE inline __attribute__((always_inline))
+#else
+#  define TP_BOX_BLUR_INLINE inline
+#endif
+
+// Contracting multiplies and adds into FMA is turned off so that every backend rounds the same way.
+#if defined(__clang__)
+#  pragma STDC FP_CONTRACT OFF
+#  define TP_BOX_BLUR_NO_CONTRACT
+#elif defined(__GNUC__)
+#  define TP_BOX_BLUR_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#  define TP_BOX_BLUR_NO_CONTRACT
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define TP_BOX_BLUR_X86
+#endif
+
+//##################################################################################################
+//! Map an index beyond either end of a line of n samples back into the line
+/*!
+\return The index of the sample to use, or n for BlurBorder::Constant where the sample is zero.
+*/
+TP_BOX_BLUR_INLINE size_t borderIndex(ptrdiff_t i, size_t n, tp_image_utils_functions::BlurBorder border)
+{
+  using Border = tp_image_utils_functions::BlurBorder;
+
+  ptrdiff_t sn = ptrdiff_t(n);
+  if(i>=0 && i<sn)
+    return size_t(i);
+
+  switch(border)
+  {
+  case Border::Clamp:
+    return i<0?0:n-1;
+
+  case Border::Wrap:
+    return size_t(((i%sn) + sn) % sn);
+
+  case Border::Mirror:
+  {
+    ptrdiff_t m = ((i%(2*sn)) + 2*sn) % (2*sn);
+    return size_t(m<sn?m:2*sn-1-m);
+  }
+
+  case Border::Constant:
+    break;
+  }
+
+  return n;
 }
 
 //##################################################################################################
-void boxBlurH_4(float* scl_, float* tcl_, size_t w, size_t h, size_t r)
+//! Box blur a row, running sums of integer types may wrap while a pixel is swapped in and out.
+template<typename T, size_t C>
+TP_BOX_BLUR_INLINE void boxBlurRow(const T* scl,
+                                   T* tiTCL,
+                                   size_t w,
+                                   size_t r,
+                                   typename BoxSum_lt<T>::Scale iarr,
+                                   tp_image_utils_functions::BlurBorder border)
 {
-  const int nCnl = 3;
+  using Sum = BoxSum_lt<T>;
+  using Acc = typename Sum::Acc;
+
+  // Borders other than clamp only look beyond the row near the ends, the middle is the same.
+  if(border != tp_image_utils_functions::BlurBorder::Clamp)
+  {
+    const std::array<T, C> zero{};
+    auto pixel = [&](ptrdiff_t i)
+    {
+      size_t j = borderIndex(i, w, border);
+      return (j<w)?(scl + j*C):zero.data();
+    };
+
+    std::array<Acc, C> val{};
+    for(ptrdiff_t j=-ptrdiff_t(r)-1; j<ptrdiff_t(r); j++)
+    {
+      const T* p = pixel(j);
+      for(size_t k=0; k<C; k++)
+        val[k] += Acc(p[k]);
+    }
+
+    auto step = [&](const T* ri, const T* li)
+    {
+      for(size_t k=0; k<C; k++)
+      {
+        val[k] += Acc(ri[k]) - Acc(li[k]);
+        tiTCL[k] = Sum::store(val[k], iarr);
+      }
+    };
+
+    size_t bodyBegin = std::min(r+1, w);
+    size_t bodyEnd = std::max(bodyBegin, (w>r)?(w-r):0);
+
+    size_t x=0;
+    for(; x<bodyBegin; x++, tiTCL+=C)
+      step(pixel(ptrdiff_t(x+r)), pixel(ptrdiff_t(x)-ptrdiff_t(r)-1));
+
+    for(; x<bodyEnd; x++, tiTCL+=C)
+      step(scl + (x+r)*C, scl + (x-r-1)*C);
+
+    for(; x<w; x++, tiTCL+=C)
+      step(pixel(ptrdiff_t(x+r)), pixel(ptrdiff_t(x)-ptrdiff_t(r)-1));
+
+    return;
+  }
+
   const size_t nHead = r+1;
   const size_t nTail = r;
+
+  const T* liSCL = scl;
+  const T* riSCL = scl+r*C;
+
+  std::array<Acc, C> fv;
+  std::array<Acc, C> lv;
+  std::array<Acc, C> val;
+
+  for(size_t k=0; k<C; k++)
+  {
+    fv[k] = Acc(scl[k]);
+    lv[k] = Acc(scl[(w-1)*C + k]);
+    val[k] = Acc(r + 1) * fv[k];
+  }
+
+  // Images narrower than the box clamp every read to the row.
+  if(w < nHead+nTail)
+  {
+    for(size_t j=0; j<r; j++)
+      for(size_t k=0; k<C; k++)
+        val[k] += Acc(scl[std::min(j, w-1)*C + k]);
+
+    for(size_t x=0; x<w; x++, tiTCL+=C)
+    {
+      const T* ri = scl + std::min(x+r, w-1)*C;
+      const T* li = scl + (x>r?x-r-1:0)*C;
+      for(size_t k=0; k<C; k++)
+      {
+        val[k] += Acc(ri[k]) - Acc(li[k]);
+        tiTCL[k] = Sum::store(val[k], iarr);
+      }
+    }
+    return;
+  }
+
   const size_t nBody = w-(nHead+nTail);
 
-  const float iarr = 1.0f / float(r + r + 1);
+  for(size_t j=0; j<r; j++)
+    for(size_t k=0; k<C; k++)
+      val[k] += Acc(scl[j*C + k]);
+
+  for(T* tiTCLMax=tiTCL+nHead*C; tiTCL<tiTCLMax; riSCL+=C, tiTCL+=C)
+  {
+    for(size_t k=0; k<C; k++)
+    {
+      val[k] += Acc(riSCL[k]) - fv[k];
+      tiTCL[k] = Sum::store(val[k], iarr);
+    }
+  }
+
+  for(T* tiTCLMax=tiTCL+nBody*C; tiTCL<tiTCLMax; liSCL+=C, riSCL+=C, tiTCL+=C)
+  {
+    for(size_t k=0; k<C; k++)
+    {
+      val[k] += Acc(riSCL[k]) - Acc(liSCL[k]);
+      tiTCL[k] = Sum::store(val[k], iarr);
+    }
+  }
 
-  std::atomic<size_t> c{0};
-  tp_utils::parallel([&](const auto& /*locker*/)
+  for(T* tiTCLMax=tiTCL+nTail*C; tiTCL<tiTCLMax; liSCL+=C, tiTCL+=C)
   {
-    for(size_t i = c++;i<h; i=c++)
+    for(size_t k=0; k<C; k++)
     {
-      float* scl = scl_ + w * i* nCnl;
-      float* tcl = tcl_ + w * i* nCnl;
+      val[k] += lv[k] - Acc(liSCL[k]);
+      tiTCL[k] = Sum::store(val[k], iarr);
+    }
+  }
+}
+
+//##################################################################################################
+//! The vertical pass keeps a running sum for each column of a block of adjacent columns.
+constexpr size_t columnBlockSize=32;
 
-      float* liSCL = scl;
-      float* riSCL = scl+r*nCnl;
-      float* tiTCL = tcl;
+//##################################################################################################
+//! Box blur a block of n interleaved values down the columns.
+template<typename T, size_t C>
+TP_BOX_BLUR_INLINE void boxBlurColumns(const T* fv,
+                                       T* ti,
+                                       size_t n,
+                                       size_t stride,
+                                       size_t h,
+                                       size_t r,
+                                       typename BoxSum_lt<T>::Scale iarr,
+                                       tp_image_utils_functions::BlurBorder border)
+{
+  using Sum = BoxSum_lt<T>;
+  using Acc = typename Sum::Acc;
 
-      float3 fv  = getf3(scl);
-      float3 lv  = getf3(scl, w - 1);
-      float3 val = float(r + 1) * fv;
+  std::array<Acc, columnBlockSize*C> val;
 
-      for(size_t j=0; j<r; j++)
-        val += getf3(scl, j);
+  // Borders other than clamp only look beyond the columns near the ends, the middle is the same.
+  if(border != tp_image_utils_functions::BlurBorder::Clamp)
+  {
+    const std::array<T, columnBlockSize*C> zero{};
+    auto rowAt = [&](ptrdiff_t i)
+    {
+      size_t j = borderIndex(i, h, border);
+      return (j<h)?(fv + j*stride):zero.data();
+    };
 
-      for(float* tiTCLMax=tiTCL+nHead*nCnl; tiTCL<tiTCLMax; riSCL+=nCnl, tiTCL+=nCnl)
-      {
-        val += getf3(riSCL) - fv;
-        setf3(tiTCL, val*iarr);
-      }
+    for(size_t k=0; k<n; k++)
+      val[k] = Acc(0);
 
-      for(float* tiTCLMax=tiTCL+nBody*nCnl; tiTCL<tiTCLMax; liSCL+=nCnl, riSCL+=nCnl, tiTCL+=nCnl)
+    for(ptrdiff_t j=-ptrdiff_t(r)-1; j<ptrdiff_t(r); j++)
+    {
+      const T* s = rowAt(j);
+      for(size_t k=0; k<n; k++)
+        val[k] += Acc(s[k]);
+    }
+
+    auto step = [&](const T* ri, const T* li)
+    {
+      for(size_t k=0; k<n; k++)
       {
-        val += getf3(riSCL) - getf3(liSCL);
-        setf3(tiTCL, val*iarr);
+        val[k] += Acc(ri[k]) - Acc(li[k]);
+        ti[k] = Sum::store(val[k], iarr);
       }
+    };
+
+    size_t bodyBegin = std::min(r+1, h);
+    size_t bodyEnd = std::max(bodyBegin, (h>r)?(h-r):0);
+
+    size_t y=0;
+    for(; y<bodyBegin; y++, ti+=stride)
+      step(rowAt(ptrdiff_t(y+r)), rowAt(ptrdiff_t(y)-ptrdiff_t(r)-1));
+
+    for(; y<bodyEnd; y++, ti+=stride)
+      step(fv + (y+r)*stride, fv + (y-r-1)*stride);
 
-      for(float* tiTCLMax=tiTCL+nTail*nCnl; tiTCL<tiTCLMax; liSCL+=nCnl, tiTCL+=nCnl)
+    for(; y<h; y++, ti+=stride)
+      step(rowAt(ptrdiff_t(y+r)), rowAt(ptrdiff_t(y)-ptrdiff_t(r)-1));
+
+    return;
+  }
+
+  const T* lv = fv + stride * (h - 1);
+
+  for(size_t k=0; k<n; k++)
+    val[k] = Acc(r + 1) * Acc(fv[k]);
+
+  // Images shorter than the box clamp every read to the column.
+  if(h < r+r+1)
+  {
+    for(size_t j=0; j<r; j++)
+    {
+      const T* s = fv + std::min(j, h-1) * stride;
+      for(size_t k=0; k<n; k++)
+        val[k] += Acc(s[k]);
+    }
+
+    for(size_t j=0; j<h; j++, ti+=stride)
+    {
+      const T* ri = fv + std::min(j+r, h-1) * stride;
+      const T* li = fv + (j>r?j-r-1:0) * stride;
+      for(size_t k=0; k<n; k++)
       {
-        val += lv - getf3(liSCL);
-        setf3(tiTCL, val*iarr);
+        val[k] += Acc(ri[k]) - Acc(li[k]);
+        ti[k] = Sum::store(val[k], iarr);
       }
     }
-  });
+    return;
+  }
+
+  for(size_t j=0; j<r; j++)
+  {
+    const T* s = fv + j * stride;
+    for(size_t k=0; k<n; k++)
+      val[k] += Acc(s[k]);
+  }
+
+  const T* li = fv;
+  const T* ri = fv + r * stride;
+
+  for(size_t j=0; j<=r; j++, ri+=stride, ti+=stride)
+  {
+    for(size_t k=0; k<n; k++)
+    {
+      val[k] += Acc(ri[k]) - Acc(fv[k]);
+      ti[k] = Sum::store(val[k], iarr);
+    }
+  }
+
+  for(size_t j=r+1; j<h-r; j++, li+=stride, ri+=stride, ti+=stride)
+  {
+    for(size_t k=0; k<n; k++)
+    {
+      val[k] += Acc(ri[k]) - Acc(li[k]);
+      ti[k] = Sum::store(val[k], iarr);
+    }
+  }
+
+  for(size_t j=h-r; j<h; j++, li+=stride, ti+=stride)
+  {
+    for(size_t k=0; k<n; k++)
+    {
+      val[k] += Acc(lv[k]) - Acc(li[k]);
+      ti[k] = Sum::store(val[k], iarr);
+    }
+  }
 }
 
 //##################################################################################################
-void boxBlurT_4(float* scl_, float* tcl_, size_t w, size_t h, size_t r)
+//! A kernel compiled once for each backend
+/*!
+The kernel is forced inline into each of the functions below so that it is compiled with that
+function's target.
+*/
+template<auto kernel>
+struct Backends_lt;
+
+//##################################################################################################
+template<typename... Args, void(*kernel)(Args...)>
+struct Backends_lt<kernel>
 {
-  const int nCnl = 3;
-  const float iarr = 1.0f / float(r + r + 1);
+  using Function = void(*)(Args...);
 
-  std::atomic<size_t> c{0};
-  tp_utils::parallel([&](const auto& /*locker*/)
+  //################################################################################################
+  TP_BOX_BLUR_NO_CONTRACT
+  static void scalar(Args... args)
   {
-    for(size_t i = c++; i < w; i = c++){
+    kernel(args...);
+  }
 
-      float* scl = scl_ + i * nCnl;
-      float* tcl = tcl_ + i * nCnl;
+#ifdef TP_BOX_BLUR_X86
+  //################################################################################################
+  TP_BOX_BLUR_NO_CONTRACT __attribute__((target("sse4.1")))
+  static void sse41(Args... args)
+  {
+    kernel(args...);
+  }
 
-      size_t ti = 0;
-      size_t li = 0;
-      size_t ri = r * w;
+  //################################################################################################
+  TP_BOX_BLUR_NO_CONTRACT __attribute__((target("avx2")))
+  static void avx2(Args... args)
+  {
+    kernel(args...);
+  }
 
-      float3 fv = getf3(scl);
-      float3 lv = getf3(scl, w * (h - 1));
-      float3 val = float(r + 1)*fv;
+  //################################################################################################
+  TP_BOX_BLUR_NO_CONTRACT __attribute__((target("avx512f,avx512bw")))
+  static void avx512(Args... args)
+  {
+    kernel(args...);
+  }
+#endif
+
+  //################################################################################################
+  //! The kernel for a backend that has already been resolved to one supported by this CPU.
+  static Function select(tp_image_utils_functions::BoxBlurBackend backend)
+  {
+    using Backend = tp_image_utils_functions::BoxBlurBackend;
+    switch(backend)
+    {
+#ifdef TP_BOX_BLUR_X86
+    case Backend::SSE41:  return &sse41;
+    case Backend::AVX2:   return &avx2;
+    case Backend::AVX512: return &avx512;
+#endif
+    default: break;
+    }
 
-      for(size_t j=0; j<r; j++)
-        val += getf3(scl, j * w);
+    return &scalar;
+  }
+};
 
-      for(size_t j=0; j<=r; j++)
-      {
-        val += getf3(scl, ri) - fv;
-        setf3(tcl, val*iarr, ti);
-        ri += w; ti += w;
-      }
+//##################################################################################################
+//! Coefficients of the Young-van Vliet recursive Gaussian
+/*!
+The causal pass is w[n] = b*x[n] + a1*w[n-1] + a2*w[n-2] + a3*w[n-3] and the anti-causal pass runs
+the same filter backwards over w. The right edge of the anti-causal pass is started using the
+Triggs-Sdika boundary matrix m, pre-multiplied by b, so that both edges behave as if the edge
+pixel extended forever.
+*/
+struct RecursiveGauss_lt
+{
+  float b;
+  float a1;
+  float a2;
+  float a3;
+  std::array<float, 9> m;
+};
 
-      for(size_t j=r+1; j<h-r; j++)
-      {
-        val += getf3(scl, ri) - getf3(scl, li);
-        setf3(tcl, val*iarr, ti);
-        li += w;
-        ri += w;
-        ti += w;
-      }
+//##################################################################################################
+RecursiveGauss_lt recursiveGauss(float sigma)
+{
+  double s = double(sigma);
+  double q = (s>=2.5)?(0.98711*s - 0.96330):(3.97156 - 4.14554*std::sqrt(1.0 - 0.26891*s));
+
+  double b0 = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
+  double a1 = (2.44413*q + 2.85619*q*q + 1.26661*q*q*q) / b0;
+  double a2 = -(1.4281*q*q + 1.26661*q*q*q) / b0;
+  double a3 = (0.422205*q*q*q) / b0;
+  double b = 1.0 - (a1 + a2 + a3);
+
+  double scale = b / ((1.0+a1-a2+a3) * (1.0-a1-a2-a3) * (1.0+a2+(a1-a3)*a3));
+
+  RecursiveGauss_lt g;
+  g.b  = float(b);
+  g.a1 = float(a1);
+  g.a2 = float(a2);
+  g.a3 = float(a3);
+  g.m[0] = float(scale * (-a3*a1 + 1.0 - a3*a3 - a2));
+  g.m[1] = float(scale * (a3+a1) * (a2+a3*a1));
+  g.m[2] = float(scale * a3 * (a1+a3*a2));
+  g.m[3] = float(scale * (a1+a3*a2));
+  g.m[4] = float(-scale * (a2-1.0) * (a2+a3*a1));
+  g.m[5] = float(-scale * a3 * (a3*a1 + a3*a3 + a2 - 1.0));
+  g.m[6] = float(scale * (a3*a1 + a2 + a1*a1 - a2*a2));
+  g.m[7] = float(scale * (a1*a2 + a3*a2*a2 - a1*a3*a3 - a3*a3*a3 - a3*a2 + a3));
+  g.m[8] = float(scale * a3 * (a1+a3*a2));
+  return g;
+}
 
-      for(size_t j=h-r; j<h; j++)
-      {
-        val += lv-getf3(scl,li);
-        setf3(tcl, val*iarr, ti);
-        li += w;
-        ti += w;
-      }
+//##################################################################################################
+//! Recursive Gaussian along n interleaved lines of length samples
+/*!
+Sample i of line k is at data[i*stride + k], tmp holds length*n floats for the causal pass.
+Rows are a single pixel of C interleaved lines and column blocks are many pixels side by side.
+*/
+template<typename T, size_t N>
+TP_BOX_BLUR_INLINE void recursiveLines(T* data, float* tmp, size_t n, size_t stride, size_t length, const RecursiveGauss_lt& g)
+{
+  using Sum = BoxSum_lt<T>;
+
+  std::array<float, N> w1;
+  std::array<float, N> w2;
+  std::array<float, N> w3;
+
+  for(size_t k=0; k<n; k++)
+    w1[k] = w2[k] = w3[k] = float(data[k]);
+
+  for(size_t i=0; i<length; i++)
+  {
+    const T* s = data + i*stride;
+    float* t = tmp + i*n;
+    for(size_t k=0; k<n; k++)
+    {
+      float v = g.b*float(s[k]) + g.a1*w1[k] + g.a2*w2[k] + g.a3*w3[k];
+      t[k] = v;
+      w3[k] = w2[k];
+      w2[k] = w1[k];
+      w1[k] = v;
     }
+  }
+
+  // w1, w2, and w3 now hold the last three causal values, use them to start the anti-causal pass.
+  T* last = data + (length-1)*stride;
+  for(size_t k=0; k<n; k++)
+  {
+    float xp = float(last[k]);
+    float d0 = w1[k] - xp;
+    float d1 = w2[k] - xp;
+    float d2 = w3[k] - xp;
+    float y0 = xp + g.m[0]*d0 + g.m[1]*d1 + g.m[2]*d2;
+    w2[k]    = xp + g.m[3]*d0 + g.m[4]*d1 + g.m[5]*d2;
+    w3[k]    = xp + g.m[6]*d0 + g.m[7]*d1 + g.m[8]*d2;
+    w1[k] = y0;
+    last[k] = Sum::fromFloat(y0);
+  }
+
+  for(size_t i=length-1; i-->0;)
+  {
+    T* d = data + i*stride;
+    const float* t = tmp + i*n;
+    for(size_t k=0; k<n; k++)
+    {
+      float v = g.b*t[k] + g.a1*w1[k] + g.a2*w2[k] + g.a3*w3[k];
+      w3[k] = w2[k];
+      w2[k] = w1[k];
+      w1[k] = v;
+      d[k] = Sum::fromFloat(v);
+    }
+  }
+}
+
+//##################################################################################################
+template<typename T, size_t C>
+TP_BOX_BLUR_INLINE void recursiveRow(T* row, float* tmp, size_t w, const RecursiveGauss_lt& g)
+{
+  recursiveLines<T, C>(row, tmp, C, C, w, g);
+}
+
+//##################################################################################################
+template<typename T, size_t C>
+TP_BOX_BLUR_INLINE void recursiveColumns(T* data, float* tmp, size_t n, size_t stride, size_t h, const RecursiveGauss_lt& g)
+{
+  recursiveLines<T, columnBlockSize*C>(data, tmp, n, stride, h, g);
+}
+
+//##################################################################################################
+template<typename T, size_t C>
+size_t boxBlur(tp_image_utils_functions::BoxBlurBackend backend,
+               tp_image_utils_functions::BlurBorder border,
+               T* scl,
+               T* aux,
+               size_t w,
+               size_t h,
+               size_t r,
+               size_t maxThreads)
+{
+  auto row = Backends_lt<&boxBlurRow<T, C>>::select(backend);
+  auto columns = Backends_lt<&boxBlurColumns<T, C>>::select(backend);
+
+  const auto iarr = BoxSum_lt<T>::scale(r);
+  const size_t stride = w * C;
+  const size_t blocks = (w + columnBlockSize - 1) / columnBlockSize;
+
+  size_t threads = tp_image_utils_functions::parallelWorkers(maxThreads, h, [&](const auto& next)
+  {
+    for(size_t i = next(); i<h; i=next())
+      row(scl + i*stride, aux + i*stride, w, r, iarr, border);
   });
+
+  threads = std::max(threads, tp_image_utils_functions::parallelWorkers(maxThreads, blocks, [&](const auto& next)
+  {
+    for(size_t b = next(); b < blocks; b = next())
+    {
+      size_t x0 = b * columnBlockSize;
+      size_t n = std::min(columnBlockSize, w - x0) * C;
+      columns(aux + x0*C, scl + x0*C, n, stride, h, r, iarr, border);
+    }
+  }));
+
+  return threads;
 }
 
 //##################################################################################################
-void boxBlur_4(float* scl, float* aux, size_t w, size_t h, size_t r)
+template<typename T, size_t C>
+size_t recursiveBlur(tp_image_utils_functions::BoxBlurBackend backend, T* data, size_t w, size_t h, float sigma, size_t maxThreads)
 {
-  boxBlurH_4(scl, aux, w, h, r);
-  boxBlurT_4(aux, scl, w, h, r);
+  auto row = Backends_lt<&recursiveRow<T, C>>::select(backend);
+  auto columns = Backends_lt<&recursiveColumns<T, C>>::select(backend);
+
+  const RecursiveGauss_lt g = recursiveGauss(sigma);
+  const size_t stride = w * C;
+  const size_t blocks = (w + columnBlockSize - 1) / columnBlockSize;
+
+  size_t threads = tp_image_utils_functions::parallelWorkers(maxThreads, h, [&](const auto& next)
+  {
+    std::vector<float> tmp(stride);
+    for(size_t i = next(); i<h; i=next())
+      row(data + i*stride, tmp.data(), w, g);
+  });
+
+  threads = std::max(threads, tp_image_utils_functions::parallelWorkers(maxThreads, blocks, [&](const auto& next)
+  {
+    std::vector<float> tmp(h*columnBlockSize*C);
+    for(size_t b = next(); b < blocks; b = next())
+    {
+      size_t x0 = b * columnBlockSize;
+      size_t n = std::min(columnBlockSize, w - x0) * C;
+      columns(data + x0*C, tmp.data(), n, stride, h, g);
+    }
+  }));
+
+  return threads;
 }
 
 }
 
 namespace tp_image_utils_functions {
 
+//##################################################################################################
+const char* boxBlurBackendToString(BoxBlurBackend backend)
+{
+  switch(backend)
+  {
+  case BoxBlurBackend::Auto:   return "Auto";
+  case BoxBlurBackend::Scalar: return "Scalar";
+  case BoxBlurBackend::SSE41:  return "SSE4.1";
+  case BoxBlurBackend::AVX2:   return "AVX2";
+  case BoxBlurBackend::AVX512: return "AVX-512";
+  }
+
+  return "Auto";
+}
+
+//##################################################################################################
+BoxBlurBackend boxBlurBackendFromString(const std::string& backend)
+{
+  if(backend == "Auto")    return BoxBlurBackend::Auto;
+  if(backend == "Scalar")  return BoxBlurBackend::Scalar;
+  if(backend == "SSE4.1")  return BoxBlurBackend::SSE41;
+  if(backend == "AVX2")    return BoxBlurBackend::AVX2;
+  if(backend == "AVX-512") return BoxBlurBackend::AVX512;
+  return BoxBlurBackend::Auto;
+}
+
+//##################################################################################################
+bool boxBlurBackendSupported(BoxBlurBackend backend)
+{
+  switch(backend)
+  {
+  case BoxBlurBackend::Auto:
+  case BoxBlurBackend::Scalar:
+    return true;
+
+#ifdef TP_BOX_BLUR_X86
+  case BoxBlurBackend::SSE41:  return __builtin_cpu_supports("sse4.1");
+  case BoxBlurBackend::AVX2:   return __builtin_cpu_supports("avx2");
+  case BoxBlurBackend::AVX512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+
+  default:
+    return false;
+  }
+}
+
+//##################################################################################################
+BoxBlurBackend resolveBoxBlurBackend(BoxBlurBackend backend)
+{
+  static const BoxBlurBackend best = []
+  {
+    for(auto b : {BoxBlurBackend::AVX512, BoxBlurBackend::AVX2, BoxBlurBackend::SSE41})
+      if(boxBlurBackendSupported(b))
+        return b;
+    return BoxBlurBackend::Scalar;
+  }();
+
+  switch(backend)
+  {
+  case BoxBlurBackend::AVX512: if(boxBlurBackendSupported(BoxBlurBackend::AVX512)) return BoxBlurBackend::AVX512; [[fallthrough]];
+  case BoxBlurBackend::AVX2:   if(boxBlurBackendSupported(BoxBlurBackend::AVX2))   return BoxBlurBackend::AVX2;   [[fallthrough]];
+  case BoxBlurBackend::SSE41:  if(boxBlurBackendSupported(BoxBlurBackend::SSE41))  return BoxBlurBackend::SSE41;  [[fallthrough]];
+  case BoxBlurBackend::Scalar: return BoxBlurBackend::Scalar;
+  case BoxBlurBackend::Auto:   break;
+  }
+
+  return best;
+}
+
 std::vector<size_t> boxesForGauss(float sigma, size_t n)
 {
   // Ideal averaging filter width
@@ -171,13 +773,69 @@ std::vector<size_t> boxesForGauss(float sigma, size_t n)
   return sizes;
 }
 
-////##################################################################################################
-void gaussBlur_4_cpu(float* scl, float* aux, size_t w, size_t h, size_t r)
+//##################################################################################################
+template<typename T, size_t Channels>
+BoxBlurInfo gaussBlurBoxes(T* scl,
+                           T* aux,
+                           size_t w,
+                           size_t h,
+                           size_t r,
+                           BlurBorder border,
+                           BoxBlurBackend backend,
+                           size_t maxThreads)
 {
+  static_assert(Channels>=1 && Channels<=4, "gaussBlurBoxes supports 1 to 4 channels.");
+
+  BoxBlurInfo info;
+  info.backend = resolveBoxBlurBackend(backend);
+
+  if(w<1 || h<1)
+    return info;
+
   std::vector<size_t> bxs = boxesForGauss(float(r), 3);
-  boxBlur_4(scl, aux, w, h, (bxs[0] - 1) / 2);
-  boxBlur_4(scl, aux, w, h, (bxs[1] - 1) / 2);
-  boxBlur_4(scl, aux, w, h, (bxs[2] - 1) / 2);
+  for(size_t b : bxs)
+    info.threads = std::max(info.threads, boxBlur<T, Channels>(info.backend, border, scl, aux, w, h, (b - 1) / 2, maxThreads));
+
+  return info;
+}
+
+//##################################################################################################
+template<typename T, size_t Channels>
+BoxBlurInfo gaussBlurRecursive(T* data, size_t w, size_t h, float sigma, BoxBlurBackend backend, size_t maxThreads)
+{
+  static_assert(Channels>=1 && Channels<=4, "gaussBlurRecursive supports 1 to 4 channels.");
+
+  BoxBlurInfo info;
+  info.backend = resolveBoxBlurBackend(backend);
+
+  if(w<1 || h<1 || !(sigma>=0.5f))
+    return info;
+
+  info.threads = recursiveBlur<T, Channels>(info.backend, data, w, h, sigma, maxThreads);
+  return info;
+}
+
+#define TP_BOX_BLUR_INSTANTIATE(T, C) \
+  template BoxBlurInfo gaussBlurBoxes<T, C>(T*, T*, size_t, size_t, size_t, BlurBorder, BoxBlurBackend, size_t); \
+  template BoxBlurInfo gaussBlurRecursive<T, C>(T*, size_t, size_t, float, BoxBlurBackend, size_t)
+
+TP_BOX_BLUR_INSTANTIATE(uint8_t , 1);
+TP_BOX_BLUR_INSTANTIATE(uint8_t , 2);
+TP_BOX_BLUR_INSTANTIATE(uint8_t , 3);
+TP_BOX_BLUR_INSTANTIATE(uint8_t , 4);
+TP_BOX_BLUR_INSTANTIATE(uint16_t, 1);
+TP_BOX_BLUR_INSTANTIATE(uint16_t, 2);
+TP_BOX_BLUR_INSTANTIATE(uint16_t, 3);
+TP_BOX_BLUR_INSTANTIATE(uint16_t, 4);
+TP_BOX_BLUR_INSTANTIATE(float   , 1);
+TP_BOX_BLUR_INSTANTIATE(float   , 2);
+TP_BOX_BLUR_INSTANTIATE(float   , 3);
+TP_BOX_BLUR_INSTANTIATE(float   , 4);
+
+//##################################################################################################
+void gaussBlur_4_cpu(float* scl, float* aux, size_t w, size_t h, size_t r)
+{
+  gaussBlurBoxes<float, 3>(scl, aux, w, h, r);
 }
 
 }
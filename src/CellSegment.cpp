@@ -8,6 +8,7 @@
 
 #include <cmath>
 #include <array>
+#include <algorithm>
 
 namespace tp_image_utils_functions
 {
@@ -15,15 +16,28 @@ namespace
 {
 
 //##################################################################################################
-void floodGrowCell(tp_image_utils::ByteMap& result,
-                   tp_image_utils::ByteMap& mask,
-                   uint8_t cellID,
-                   int x,
-                   int y)
+//! The pixels x0 <= x < x1 and y0 <= y < y1
+struct Rect_lt
+{
+  size_t x0{0};
+  size_t y0{0};
+  size_t x1{0};
+  size_t y1{0};
+};
+
+//##################################################################################################
+//! Returns the bounding rect of the mask pixels that were cleared.
+Rect_lt floodGrowCell(tp_image_utils::ByteMap& result,
+                      tp_image_utils::ByteMap& mask,
+                      uint8_t cellID,
+                      int x,
+                      int y)
 {
   size_t w = result.width();
   size_t h = result.height();
 
+  Rect_lt changed{w, h, 0, 0};
+
   tp_image_utils::ByteMap done(w, h);
   done.fill(0);
   std::vector<std::pair<size_t, size_t>> queue;
@@ -48,23 +62,31 @@ void floodGrowCell(tp_image_utils::ByteMap& result,
     mask.setPixel(px, py, 0);
     result.setPixel(px, py, cellID);
 
+    changed.x0 = tpMin(changed.x0, px  );
+    changed.y0 = tpMin(changed.y0, py  );
+    changed.x1 = tpMax(changed.x1, px+1);
+    changed.y1 = tpMax(changed.y1, py+1);
+
     queue.emplace_back(px+1, py  );
     queue.emplace_back(px,   py-1);
     queue.emplace_back(px-1, py  );
     queue.emplace_back(px  , py+1);
   }
+
+  return changed;
 }
 
 //##################################################################################################
-void boxGrowCell(tp_image_utils::ByteMap& result,
-                 tp_image_utils::ByteMap& mask,
-                 const CellSegmentParameters& params,
-                 int w,
-                 int h,
-                 uint8_t cellID,
-                 int v,
-                 int x,
-                 int y)
+//! Returns the rect of mask pixels that were cleared.
+Rect_lt boxGrowCell(tp_image_utils::ByteMap& result,
+                    tp_image_utils::ByteMap& mask,
+                    const CellSegmentParameters& params,
+                    int w,
+                    int h,
+                    uint8_t cellID,
+                    int v,
+                    int x,
+                    int y)
 {
   int r    = (v*params.distanceFieldRadius)/256;// The radius of a circle that fits inside the square.
   int half = int(std::sqrt((r*r)/2));           // The half width of the square.
@@ -94,7 +116,7 @@ void boxGrowCell(tp_image_utils::ByteMap& result,
 
         size_t c = v+1;
 
-        if(c>size_t(w))
+        if(c>=size_t(w))
           break;
 
         bool ok = true;
@@ -129,7 +151,7 @@ void boxGrowCell(tp_image_utils::ByteMap& result,
 
         size_t c = size_t(v)+1;
 
-        if(c>size_t(w))
+        if(c>=size_t(h))
           break;
 
         bool ok = true;
@@ -244,6 +266,8 @@ void boxGrowCell(tp_image_utils::ByteMap& result,
       (*d) = cellID;
     }
   }
+
+  return {cxInt, cyInt, cxMax, cyMax};
 }
 }
 
@@ -281,29 +305,44 @@ tp_image_utils::ByteMap cellSegmentInitialCells(const tp_image_utils::ByteMap& s
   //Here we try to fill the larger internal areas with squares, later we will pitch these squares
   //against each other to best fill the internal cavities.
   {
-    //The mask will get filled out as we generate the initial cells
+    //The mask will get filled out as we generate the initial cells, each cell only modifies a small
+    //part of the mask so the distance field is updated incrementally.
     tp_image_utils::ByteMap mask = src;
+    IncrementalDistanceField distanceField(mask, params.distanceFieldRadius);
+    const tp_image_utils::ByteMap& ds = distanceField.field();
+
+    //The max value in each row of the distance field, used to find the most remote pixel.
+    std::vector<uint8_t> rowMax(h, 0);
+    auto updateRowMax = [&](size_t yMin, size_t yMax)
+    {
+      for(size_t y=yMin; y<yMax; y++)
+      {
+        const uint8_t* s = ds.constData() + (y*w);
+        const uint8_t* sMax = s + w;
+        uint8_t v=0;
+        for(; s<sMax; s++)
+          if(v<(*s))
+            v = *s;
+        rowMax[y] = v;
+      }
+    };
+    updateRowMax(0, h);
+
     uint8_t cellID = 0;
     for(int p=0; p<params.maxInitialCells; p++)
     {
-      tp_utils::ElapsedTimer tt2;
-      tt2.start();
-      tp_image_utils::ByteMap ds = distanceField(mask, params.distanceFieldRadius);
-
-      const uint8_t* s = ds.constData();
-      const uint8_t* sMax = s + ds.size();
       uint8_t v=0;
-      const uint8_t* b = nullptr;
-      for(; s<sMax; s++)
+      size_t y=0;
+      for(size_t r=0; r<h; r++)
       {
-        if(v<(*s))
+        if(v<rowMax[r])
         {
-          v = *s;
-          b = s;
+          v = rowMax[r];
+          y = r;
         }
       }
 
-      if(b == nullptr)
+      if(v==0)
         break;
 
       if(v<params.minRadius)
@@ -311,21 +350,29 @@ tp_image_utils::ByteMap cellSegmentInitialCells(const tp_image_utils::ByteMap& s
 
       cellID++;
 
-      size_t i = size_t(b - ds.constData()); // Index of the most remote pixel.
-      size_t y = i / w;                      // Y coordinate of the most remote pixel.
-      size_t x = i - (y*w);                  // X coordinate of the most remote pixel.
+      // X coordinate of the most remote pixel.
+      size_t x = size_t(std::find(ds.constData()+(y*w), ds.constData()+((y+1)*w), v) - (ds.constData()+(y*w)));
 
+      Rect_lt changed;
       switch(params.cellGrowMode)
       {
       case CellGrowMode::Box:
-        boxGrowCell(result, mask, params, int(w), int(h), cellID, v, int(x), int(y));
+        changed = boxGrowCell(result, mask, params, int(w), int(h), cellID, v, int(x), int(y));
         break;
 
       case CellGrowMode::Flood:
-        floodGrowCell(result, mask, cellID, int(x), int(y));
+        changed = floodGrowCell(result, mask, cellID, int(x), int(y));
         break;
       }
 
+      if(changed.x0<changed.x1 && changed.y0<changed.y1)
+      {
+        distanceField.update(mask, changed.x0, changed.y0, changed.x1-changed.x0, changed.y1-changed.y0);
+
+        auto r = size_t(tpMax(0, params.distanceFieldRadius));
+        updateRowMax((changed.y0>r)?(changed.y0-r):0, tpMin(h, changed.y1+r));
+      }
+
       if(cellID==255)
         break;
     }
@@ -0,0 +1,202 @@
+#include "tp_image_utils_functions/ComponentTree.h"
+
+#include "PrivateUtils.h"
+
+#include <algorithm>
+#include <array>
+
+namespace tp_image_utils_functions
+{
+
+namespace
+{
+
+//##################################################################################################
+//! Set each pixel to the level of its closest node that passes keep, the root always passes.
+template<typename Keep>
+tp_image_utils::ByteMap filterNodes(const ComponentTree& tree, const Keep& keep)
+{
+  tp_image_utils::ByteMap dst(tree.w, tree.h);
+  if(tree.nodes.empty())
+    return dst;
+
+  // Parents come before their children so each ancestor has been resolved before it is needed.
+  std::vector<uint8_t> levels(tree.nodes.size());
+  levels[0] = tree.nodes[0].value;
+  for(size_t i=1; i<tree.nodes.size(); i++)
+  {
+    const ByteRegion& node = tree.nodes[i];
+    levels[i] = keep(node)?node.value:levels[size_t(tree.parents[i])];
+  }
+
+  uint8_t* d = dst.data();
+  const int* m = tree.map.data();
+  const int* mMax = m + tree.map.size();
+  for(; m<mMax; m++, d++)
+    (*d) = levels[size_t(*m)];
+
+  return dst;
+}
+}
+
+//##################################################################################################
+ComponentTree::ComponentTree(const tp_image_utils::ByteMap& src, ComponentTreeType treeType, bool addCorners):
+  type(treeType),
+  w(src.width()),
+  h(src.height())
+{
+  size_t n = w*h;
+  if(n<1)
+    return;
+
+  const uint8_t* s = src.constData();
+
+  // Sort the pixels from the top of the tree to the root, a MaxTree starts at the brightest.
+  std::vector<int> order(n);
+  {
+    auto key = [&](uint8_t v){return (type==ComponentTreeType::MaxTree)?uint8_t(255-v):v;};
+
+    std::array<size_t, 257> starts{};
+    for(size_t i=0; i<n; i++)
+      starts[size_t(key(s[i]))+1]++;
+
+    for(size_t i=1; i<starts.size(); i++)
+      starts[i] += starts[i-1];
+
+    for(size_t i=0; i<n; i++)
+      order[starts[key(s[i])]++] = int(i);
+  }
+
+  // Berger's algorithm, each pixel becomes the parent of the sets of the neighbours that have
+  // already been visited. zpar holds the union-find sets, joined by rank, and -1 for pixels not yet
+  // visited. repr holds the most recent pixel of each set, that is the pixel the set hangs from.
+  std::vector<int> parent(n);
+  std::vector<int> zpar(n, -1);
+  {
+    std::vector<int> repr(n);
+    std::vector<uint8_t> rank(n, 0);
+
+    int zp=0;
+    auto join = [&](int p, int q)
+    {
+      if(zpar[size_t(q)]<0)
+        return;
+
+      int r = findRoot(zpar.data(), q);
+      if(r==zp)
+        return;
+
+      parent[size_t(repr[size_t(r)])] = p;
+      if(rank[size_t(zp)]<rank[size_t(r)])
+        std::swap(zp, r);
+      zpar[size_t(r)] = zp;
+      if(rank[size_t(zp)]==rank[size_t(r)])
+        rank[size_t(zp)]++;
+      repr[size_t(zp)] = p;
+    };
+
+    int iw = int(w);
+    for(int p : order)
+    {
+      parent[size_t(p)] = p;
+      zpar[size_t(p)] = p;
+      repr[size_t(p)] = p;
+      zp = p;
+
+      size_t x = size_t(p)%w;
+      size_t y = size_t(p)/w;
+      bool left  = x>0;
+      bool right = x+1<w;
+
+      if(left)
+        join(p, p-1);
+      if(right)
+        join(p, p+1);
+
+      if(y>0)
+      {
+        join(p, p-iw);
+        if(addCorners && left)
+          join(p, p-iw-1);
+        if(addCorners && right)
+          join(p, p-iw+1);
+      }
+
+      if(y+1<h)
+      {
+        join(p, p+iw);
+        if(addCorners && left)
+          join(p, p+iw-1);
+        if(addCorners && right)
+          join(p, p+iw+1);
+      }
+    }
+  }
+
+  // Visit from the root outwards so that every parent is canonical before its children. A pixel is
+  // canonical if it is the root or its parent has a different level, canonical pixels become nodes.
+  map.swap(zpar);
+  for(auto i=order.rbegin(); i!=order.rend(); ++i)
+  {
+    auto p = size_t(*i);
+    auto q = size_t(parent[p]);
+    if(s[size_t(parent[q])]==s[q])
+      parent[p] = parent[q];
+    q = size_t(parent[p]);
+
+    if(p==q || s[q]!=s[p])
+    {
+      map[p] = int(nodes.size());
+      parents.push_back((p==q)?-1:map[q]);
+
+      ByteRegion& node = nodes.emplace_back();
+      node.value = s[p];
+      node.minX = w;
+      node.minY = h;
+    }
+    else
+      map[p] = map[q];
+  }
+
+  // Count the pixels at the level of each node then add the children to their parents.
+  {
+    const int* m = map.data();
+    for(size_t y=0; y<h; y++)
+    {
+      for(size_t x=0; x<w; x++, m++)
+      {
+        ByteRegion& node = nodes[size_t(*m)];
+        node.count++;
+        node.minX = std::min(node.minX, x);
+        node.maxX = std::max(node.maxX, x);
+        node.minY = std::min(node.minY, y);
+        node.maxY = std::max(node.maxY, y);
+      }
+    }
+  }
+
+  for(size_t i=nodes.size()-1; i>0; i--)
+  {
+    const ByteRegion& node = nodes[i];
+    ByteRegion& p = nodes[size_t(parents[i])];
+    p.count += node.count;
+    p.minX = std::min(p.minX, node.minX);
+    p.maxX = std::max(p.maxX, node.maxX);
+    p.minY = std::min(p.minY, node.minY);
+    p.maxY = std::max(p.maxY, node.maxY);
+  }
+}
+
+//##################################################################################################
+tp_image_utils::ByteMap ComponentTree::attributeFilter(const std::function<bool(const ByteRegion&)>& keep)const
+{
+  return filterNodes(*this, keep);
+}
+
+//##################################################################################################
+tp_image_utils::ByteMap ComponentTree::areaFilter(size_t minArea)const
+{
+  return filterNodes(*this, [minArea](const ByteRegion& node){return node.count>=minArea;});
+}
+
+}
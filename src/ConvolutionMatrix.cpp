@@ -1,12 +1,23 @@
 #include "tp_image_utils_functions/ConvolutionMatrix.h"
+#include "tp_image_utils_functions/BoxBlur.h"
 
 #include "tp_image_utils/ColorMap.h"
 #include "tp_image_utils/ColorMapF.h"
+#include "tp_image_utils/ByteMap.h"
 
 #include "tp_utils/Parallel.h"
 
 #include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
 #include <atomic>
+#include <array>
+#include <utility>
+#include <complex>
+#include <memory>
+#include <mutex>
+#include <type_traits>
 
 namespace tp_image_utils_functions
 {
@@ -14,163 +25,1030 @@ namespace tp_image_utils_functions
 namespace
 {
 //##################################################################################################
-/*!
- * \param sigma standard deviation
- * \param n number of boxes
- * \return
- */
-std::vector<size_t> boxesForGauss(float sigma, size_t n)
+//! Rank 1 test, the row through the largest element is scaled by each element of its column.
+template<typename T>
+bool separate(const std::vector<T>& matrixData, size_t width, size_t height, std::vector<T>& row, std::vector<T>& column)
+{
+  if(width<1 || height<1 || (width*height)>matrixData.size())
+    return false;
+
+  size_t px=0;
+  size_t py=0;
+  T pivot=0;
+  for(size_t y=0; y<height; y++)
+  {
+    for(size_t x=0; x<width; x++)
+    {
+      T v = matrixData[(y*width)+x];
+      if(std::fabs(v)>std::fabs(pivot))
+      {
+        pivot = v;
+        px = x;
+        py = y;
+      }
+    }
+  }
+
+  if(pivot==T(0))
+    return false;
+
+  row.resize(width);
+  column.resize(height);
+
+  for(size_t x=0; x<width; x++)
+    row[x] = matrixData[(py*width)+x];
+
+  for(size_t y=0; y<height; y++)
+    column[y] = matrixData[(y*width)+px] / pivot;
+
+  T tolerance = std::fabs(pivot) * T(1.0e-6);
+  for(size_t y=0; y<height; y++)
+    for(size_t x=0; x<width; x++)
+      if(std::fabs(matrixData[(y*width)+x] - (column[y]*row[x]))>tolerance)
+        return false;
+
+  return true;
+}
+
+//##################################################################################################
+//! Matrix weights scaled by 2^shift and rounded to integers.
+template<typename Acc>
+struct FixedWeights_lt
+{
+  std::vector<Acc> weights;
+  int shift{0};
+};
+
+//##################################################################################################
+//! The largest shift that keeps sum(|weights|)*maxInput*2^shift within half the range of Acc.
+template<typename Acc>
+int fixedShift(const std::vector<double>& weights, double maxInput, int maxShift)
+{
+  double sum=0.0;
+  for(double w : weights)
+    sum += std::fabs(w);
+
+  double range = double(std::numeric_limits<Acc>::max()/2);
+  double limit = range / tpMax(sum*maxInput, 1.0e-12);
+  return tpBound(0, int(std::floor(std::log2(limit))), maxShift);
+}
+
+//##################################################################################################
+template<typename Acc>
+FixedWeights_lt<Acc> quantizeWeights(const std::vector<double>& weights, int shift)
 {
-  // Ideal averaging filter width
-  float wIdeal = std::sqrt((12.0f * sigma*sigma / float(n)) + 1.0f);
+  FixedWeights_lt<Acc> fixed;
+  fixed.shift = shift;
+  fixed.weights.resize(weights.size());
+
+  if(weights.empty())
+    return fixed;
+
+  double scale = std::ldexp(1.0, shift);
+  double sum=0.0;
+  Acc fixedSum=0;
+  size_t largest=0;
+  for(size_t i=0; i<weights.size(); i++)
+  {
+    fixed.weights[i] = Acc(std::llround(weights[i]*scale));
+    sum += weights[i];
+    fixedSum += fixed.weights[i];
+    if(std::fabs(weights[i])>std::fabs(weights[largest]))
+      largest = i;
+  }
+
+  //Keep the sum of the weights exact so that flat regions keep their value.
+  fixed.weights[largest] += Acc(std::llround(sum*scale)) - fixedSum;
+
+  return fixed;
+}
+
+//##################################################################################################
+//! Accumulators are processed in blocks that stay in L1 while every tap is added.
+constexpr size_t accBlockSize=1024;
 
-  size_t wl = size_t(std::floor(wIdeal));
-  if(wl % 2 == 0)
-    wl--;
+//##################################################################################################
+template<typename Acc>
+void storeRow(const Acc* acc, size_t n, int shift, uint8_t* dst)
+{
+  for(size_t i=0; i<n; i++)
+    dst[i] = uint8_t(tpBound(Acc(0), Acc(acc[i]>>shift), Acc(255)));
+}
 
-  size_t wu = wl + 2;
+//##################################################################################################
+//! Apply a 2D matrix to n interleaved values of one output row.
+template<typename Acc>
+void convolveRow(const uint8_t* src,
+                 size_t srcStride,
+                 size_t channels,
+                 size_t n,
+                 const FixedWeights_lt<Acc>& matrix,
+                 size_t width,
+                 size_t height,
+                 Acc* acc,
+                 uint8_t* dst)
+{
+  for(size_t b=0; b<n; b+=accBlockSize)
+  {
+    size_t bn = tpMin(accBlockSize, n-b);
+    std::fill(acc, acc+bn, Acc(0));
 
-  auto mIdeal = (12 * sigma*sigma - n * wl*wl - 4 * n*wl - 3 * n) / (-4 * wl - 4);
-  size_t m = size_t(std::round(mIdeal));
+    const Acc* w = matrix.weights.data();
+    for(size_t my=0; my<height; my++)
+    {
+      const uint8_t* s = src + (my*srcStride) + b;
+      for(size_t mx=0; mx<width; mx++, w++, s+=channels)
+      {
+        Acc weight = *w;
+        if(weight==0)
+          continue;
+
+        for(size_t i=0; i<bn; i++)
+          acc[i] += Acc(s[i]) * weight;
+      }
+    }
+
+    storeRow(acc, bn, matrix.shift, dst+b);
+  }
+}
+
+//##################################################################################################
+//! Horizontal pass of a separable matrix, the sums are shifted right by downShift.
+template<typename Acc>
+void filterRow(const uint8_t* src, size_t channels, size_t n, const FixedWeights_lt<Acc>& row, int downShift, Acc* dst)
+{
+  for(size_t b=0; b<n; b+=accBlockSize)
+  {
+    size_t bn = tpMin(accBlockSize, n-b);
+    Acc* d = dst+b;
+    std::fill(d, d+bn, Acc(0));
+
+    const uint8_t* s = src + b;
+    for(size_t mx=0; mx<row.weights.size(); mx++, s+=channels)
+    {
+      Acc weight = row.weights[mx];
+      if(weight==0)
+        continue;
 
-  std::vector<size_t> sizes(n);
-  for (size_t i=0; i<n; i++)
-    sizes[i] = i < m ? wl : wu;
+      for(size_t i=0; i<bn; i++)
+        d[i] += Acc(s[i]) * weight;
+    }
 
-  return sizes;
+    for(size_t i=0; i<bn; i++)
+      d[i] >>= downShift;
+  }
 }
 
 //##################################################################################################
-void boxBlurH_4(glm::vec3* scl, glm::vec3* tcl, size_t w, size_t h, size_t r)
+template<typename Acc>
+void convolveBytes2D(const uint8_t* src,
+                     size_t srcWidth,
+                     size_t channels,
+                     uint8_t* dst,
+                     size_t dw,
+                     size_t dh,
+                     const std::vector<double>& matrixData,
+                     size_t width,
+                     size_t height,
+                     int shift)
 {
-  const size_t nHead = r+1;
-  const size_t nTail = r;
-  const size_t nBody = w-(nHead+nTail);
+  auto matrix = quantizeWeights<Acc>(matrixData, shift);
 
-  const float iarr = 1.0f / float(r + r + 1);
+  size_t n = dw*channels;
+  size_t srcStride = srcWidth*channels;
 
   std::atomic<size_t> c{0};
   tp_utils::parallel([&](auto /*locker*/)
   {
-    for(;;)
+    std::vector<Acc> acc(tpMin(n, accBlockSize));
+    for(size_t y=c++; y<dh; y=c++)
+      convolveRow(src+(y*srcStride), srcStride, channels, n, matrix, width, height, acc.data(), dst+(y*n));
+  });
+}
+
+//##################################################################################################
+//! Vertical pass of a separable matrix over a ring buffer of height filtered rows.
+template<typename Acc>
+void combineRows(const Acc* rows,
+                 size_t y,
+                 size_t n,
+                 const FixedWeights_lt<Acc>& column,
+                 int outputShift,
+                 Acc* acc,
+                 uint8_t* dst)
+{
+  size_t height = column.weights.size();
+  for(size_t b=0; b<n; b+=accBlockSize)
+  {
+    size_t bn = tpMin(accBlockSize, n-b);
+    std::fill(acc, acc+bn, Acc(0));
+    for(size_t my=0; my<height; my++)
     {
-      size_t const i = c++;
+      Acc weight = column.weights[my];
+      const Acc* s = rows + (((y+my)%height)*n) + b;
+      for(size_t i=0; i<bn; i++)
+        acc[i] += s[i] * weight;
+    }
+    storeRow(acc, bn, outputShift, dst+b);
+  }
+}
 
-      if(i>=h)
-        return;
+//##################################################################################################
+//! Fixed point weights of a separable matrix
+template<typename Acc>
+struct SeparableWeights_lt
+{
+  FixedWeights_lt<Acc> row;
+  FixedWeights_lt<Acc> column;
+  int downShift{0};   //!< Shift applied to the horizontal pass leaving 8 bits of fraction.
+  int outputShift{0}; //!< Shift applied to the vertical pass.
+};
 
-      {
-        size_t ti = i * w;
-        size_t li = ti;
-        size_t ri = ti + r;
+//##################################################################################################
+//! Returns false if Acc can not hold the filtered rows with 8 bits of fraction.
+template<typename Acc>
+bool separableWeights(const std::vector<double>& row,
+                      const std::vector<double>& column,
+                      int maxShift,
+                      SeparableWeights_lt<Acc>& weights)
+{
+  double rowSum=0.0;
+  for(double w : row)
+    rowSum += std::fabs(w);
 
-        glm::vec3* liSCL = &scl[li];
-        glm::vec3* riSCL = &scl[ri];
-        glm::vec3* tiTCL = &tcl[ti];
+  int rowShift = fixedShift<Acc>(row, 255.0, maxShift);
+  int fractionBits = tpMin(rowShift, 8);
+  double maxFiltered = 255.0 * rowSum * std::ldexp(1.0, fractionBits);
+  int columnShift = fixedShift<Acc>(column, maxFiltered, maxShift);
 
-        glm::vec3 fv = scl[ti];
-        glm::vec3 lv = scl[ti + w - 1];
-        glm::vec3 val = float(r + 1)*fv;
+  weights.row         = quantizeWeights<Acc>(row, rowShift);
+  weights.column      = quantizeWeights<Acc>(column, columnShift);
+  weights.downShift   = rowShift - fractionBits;
+  weights.outputShift = columnShift + fractionBits;
 
-        for(size_t j=0; j<r; j++)
-          val += scl[ti+j];
+  return rowShift>=8 && columnShift>=8;
+}
 
-        for(glm::vec3* tiTCLMax=tiTCL+nHead; tiTCL<tiTCLMax; riSCL++, tiTCL++)
-        {
-          val += *riSCL - fv;
-          (*tiTCL) = val*iarr;
-        }
+//##################################################################################################
+//! Output rows are processed in bands, each band of a separable matrix primes its own ring buffer.
+constexpr size_t bandHeight=32;
 
-        for(glm::vec3* tiTCLMax=tiTCL+nBody; tiTCL<tiTCLMax; liSCL++, riSCL++, tiTCL++)
-        {
-          val += *riSCL - *liSCL;
-          (*tiTCL) = val*iarr;
-        }
+//##################################################################################################
+template<typename Acc>
+void convolveBytesSeparable(const uint8_t* src,
+                            size_t srcWidth,
+                            size_t channels,
+                            uint8_t* dst,
+                            size_t dw,
+                            size_t dh,
+                            const SeparableWeights_lt<Acc>& weights)
+{
+  size_t height = weights.column.weights.size();
+  size_t n = dw*channels;
+  size_t srcStride = srcWidth*channels;
+  size_t bands = (dh+bandHeight-1) / bandHeight;
 
-        for(glm::vec3* tiTCLMax=tiTCL+nTail; tiTCL<tiTCLMax; liSCL++, tiTCL++)
-        {
-          val += lv - *liSCL;
-          (*tiTCL) = val*iarr;
-        }
+  std::atomic<size_t> c{0};
+  tp_utils::parallel([&](auto /*locker*/)
+  {
+    std::vector<Acc> rows(n*height);
+    std::vector<Acc> acc(tpMin(n, accBlockSize));
+
+    auto filter = [&](size_t y)
+    {
+      filterRow(src+(y*srcStride), channels, n, weights.row, weights.downShift, rows.data()+((y%height)*n));
+    };
+
+    for(size_t band=c++; band<bands; band=c++)
+    {
+      size_t y0 = band*bandHeight;
+      size_t y1 = tpMin(y0+bandHeight, dh);
+
+      for(size_t y=y0; y<(y0+height-1); y++)
+        filter(y);
+
+      for(size_t y=y0; y<y1; y++)
+      {
+        filter(y+height-1);
+        combineRows(rows.data(), y, n, weights.column, weights.outputShift, acc.data(), dst+(y*n));
       }
     }
   });
 }
 
 //##################################################################################################
-void boxBlurT_4(glm::vec3* scl, glm::vec3* tcl, size_t w, size_t h, size_t r)
+//! The index of the only non zero weight if it is one, otherwise matrixData.size().
+size_t unitWeightIndex(const std::vector<double>& matrixData)
 {
-  float iarr = 1.0f / float(r + r + 1);
+  size_t i = size_t(std::find_if(matrixData.begin(), matrixData.end(), [](double v){return v!=0.0;}) - matrixData.begin());
+  if(i<matrixData.size() && matrixData[i]==1.0 && std::all_of(matrixData.begin()+i+1, matrixData.end(), [](double v){return v==0.0;}))
+    return i;
+  return matrixData.size();
+}
 
-  std::atomic<size_t> c{0};
-  tp_utils::parallel([&](auto /*locker*/)
+//##################################################################################################
+//! Apply a matrix to interleaved 8 bit channels using fixed point weights
+/*!
+Results are truncated and clamped to 0-255 like the original floating point implementation. 32 bit
+accumulators are used unless the matrix weights are too large to keep 8 bits of fraction, the
+inner loops are contiguous integer multiply adds written for the compiler to vectorize.
+
+\param row - The horizontal kernel if the matrix is separable, otherwise empty.
+\param column - The vertical kernel if the matrix is separable, otherwise empty.
+*/
+void convolveBytes(const uint8_t* src,
+                   size_t srcWidth,
+                   size_t channels,
+                   uint8_t* dst,
+                   size_t dw,
+                   size_t dh,
+                   const std::vector<double>& matrixData,
+                   size_t width,
+                   size_t height,
+                   const std::vector<double>& row,
+                   const std::vector<double>& column)
+{
+  //The identity and other matrices with a single weight of one are a copy of part of the source.
+  if(size_t i=unitWeightIndex(matrixData); i<matrixData.size())
+  {
+    size_t n = dw*channels;
+    const uint8_t* s = src + ((((i/width)*srcWidth) + (i%width))*channels);
+    for(size_t y=0; y<dh; y++, s+=srcWidth*channels, dst+=n)
+      std::memcpy(dst, s, n);
+    return;
+  }
+
+  if(!row.empty() && !column.empty())
   {
-    for(;;)
+    if(SeparableWeights_lt<int32_t> weights; separableWeights(row, column, 24, weights))
+      convolveBytesSeparable(src, srcWidth, channels, dst, dw, dh, weights);
+    else
     {
-      size_t const i = c++;
+      SeparableWeights_lt<int64_t> wideWeights;
+      separableWeights(row, column, 32, wideWeights);
+      convolveBytesSeparable(src, srcWidth, channels, dst, dw, dh, wideWeights);
+    }
+    return;
+  }
 
-      if(i>=w)
-        return;
+  if(int shift = fixedShift<int32_t>(matrixData, 255.0, 24); shift>=8)
+    convolveBytes2D<int32_t>(src, srcWidth, channels, dst, dw, dh, matrixData, width, height, shift);
+  else
+    convolveBytes2D<int64_t>(src, srcWidth, channels, dst, dw, dh, matrixData, width, height, fixedShift<int64_t>(matrixData, 255.0, 32));
+}
 
-      size_t ti = i;
-      size_t li = ti;
-      size_t ri = ti + r * w;
+//##################################################################################################
+//! Non separable matrices with at least this many elements are applied using FFTs.
+constexpr size_t fftMatrixSize=225;
+
+//##################################################################################################
+//! Added to FFT results before truncating, results that should be whole numbers can come back a
+//! tiny amount low and would otherwise drop by one, so flat regions would not keep their value.
+constexpr double fftRoundingBias=1e-6;
+
+//##################################################################################################
+size_t nextPowerOfTwo(size_t n)
+{
+  size_t p=1;
+  while(p<n)
+    p<<=1;
+  return p;
+}
 
-      glm::vec3 fv = scl[ti];
-      glm::vec3 lv = scl[ti + w * (h - 1)];
-      glm::vec3 val = float(r + 1)*fv;
+//##################################################################################################
+//! Twiddle factors exp(-2*pi*i*k/n) for k<n/2.
+std::vector<std::complex<double>> twiddleFactors(size_t n)
+{
+  constexpr double pi = 3.14159265358979323846;
+  std::vector<std::complex<double>> twiddles(n/2);
+  for(size_t k=0; k<twiddles.size(); k++)
+    twiddles[k] = std::polar(1.0, -2.0*pi*double(k)/double(n));
+  return twiddles;
+}
 
-      for(size_t j=0; j<r; j++)
-        val += scl[ti + j * w];
+//##################################################################################################
+//! In place radix-2 FFT, n must be a power of two, the inverse is not scaled.
+void fft(std::complex<double>* data, size_t n, const std::vector<std::complex<double>>& twiddles, bool inverse)
+{
+  for(size_t i=1, j=0; i<n; i++)
+  {
+    size_t bit = n>>1;
+    for(; j&bit; bit>>=1)
+      j ^= bit;
+    j ^= bit;
 
-      for(size_t j=0; j<=r; j++)
+    if(i<j)
+      std::swap(data[i], data[j]);
+  }
+
+  for(size_t len=2; len<=n; len<<=1)
+  {
+    size_t half = len/2;
+    size_t step = n/len;
+    for(size_t i=0; i<n; i+=len)
+    {
+      std::complex<double>* a = data+i;
+      std::complex<double>* b = a+half;
+      for(size_t k=0; k<half; k++)
       {
-        val += scl[ri] - fv;
-        tcl[ti] = val*iarr;
-        ri += w; ti += w;
+        std::complex<double> w = inverse?std::conj(twiddles[k*step]):twiddles[k*step];
+        std::complex<double> v = b[k] * w;
+        b[k] = a[k] - v;
+        a[k] += v;
       }
+    }
+  }
+}
+
+//##################################################################################################
+//! 2D FFT of a width*height tile stored as rows.
+struct FFT2D_lt
+{
+  size_t width;
+  size_t height;
+  std::vector<std::complex<double>> rowTwiddles;
+  std::vector<std::complex<double>> columnTwiddles;
+
+  //################################################################################################
+  FFT2D_lt(size_t width_, size_t height_):
+    width(width_),
+    height(height_),
+    rowTwiddles(twiddleFactors(width_)),
+    columnTwiddles(twiddleFactors(height_))
+  {
+
+  }
+
+  //################################################################################################
+  void transform(std::complex<double>* data, std::vector<std::complex<double>>& column, bool inverse)const
+  {
+    for(size_t y=0; y<height; y++)
+      fft(data+(y*width), width, rowTwiddles, inverse);
+
+    column.resize(height);
+    for(size_t x=0; x<width; x++)
+    {
+      for(size_t y=0; y<height; y++)
+        column[y] = data[(y*width)+x];
+
+      fft(column.data(), height, columnTwiddles, inverse);
+
+      for(size_t y=0; y<height; y++)
+        data[(y*width)+x] = column[y];
+    }
+  }
+};
+
+//##################################################################################################
+//! The spectrum of the matrix for the last tile size used
+struct KernelSpectrumCache_lt
+{
+  std::mutex mutex;
+  size_t width{0};
+  size_t height{0};
+  std::shared_ptr<const std::vector<std::complex<double>>> spectrum;
+};
+
+//##################################################################################################
+//! The spectrum of the flipped matrix, scaled so that the inverse transform needs no scaling.
+std::shared_ptr<const std::vector<std::complex<double>>> kernelSpectrum(KernelSpectrumCache_lt& cache,
+                                                                         const FFT2D_lt& fft2D,
+                                                                         const std::vector<double>& matrixData,
+                                                                         size_t width,
+                                                                         size_t height)
+{
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  if(cache.spectrum && cache.width==fft2D.width && cache.height==fft2D.height)
+    return cache.spectrum;
+
+  size_t fw = fft2D.width;
+  size_t fh = fft2D.height;
+  double scale = 1.0 / double(fw*fh);
+
+  //Correlation with the matrix is convolution with the matrix mirrored about the origin.
+  auto spectrum = std::make_shared<std::vector<std::complex<double>>>(fw*fh);
+  for(size_t my=0; my<height; my++)
+    for(size_t mx=0; mx<width; mx++)
+      (*spectrum)[(((fh-my)%fh)*fw) + ((fw-mx)%fw)] = matrixData[(my*width)+mx] * scale;
+
+  std::vector<std::complex<double>> column;
+  fft2D.transform(spectrum->data(), column, false);
+
+  cache.width = fw;
+  cache.height = fh;
+  cache.spectrum = spectrum;
+  return cache.spectrum;
+}
+
+//##################################################################################################
+//! Apply a matrix to interleaved 8 bit channels using overlap-save FFT tiles
+/*!
+Tiles are sized to a power of two several times larger than the matrix, so the kernel spectrum only
+depends on the matrix and is reused across images. Pairs of channels are transformed together as
+the real and imaginary parts of one complex tile.
+
+\param activeChannels - The number of leading channels to calculate, the rest are left untouched.
+*/
+void convolveBytesFFT(const uint8_t* src,
+                      size_t srcWidth,
+                      size_t srcHeight,
+                      size_t channels,
+                      size_t activeChannels,
+                      uint8_t* dst,
+                      size_t dw,
+                      size_t dh,
+                      const std::vector<double>& matrixData,
+                      size_t width,
+                      size_t height,
+                      KernelSpectrumCache_lt& cache)
+{
+  auto tileSize = [](size_t matrixSize, size_t imageSize)
+  {
+    return tpMin(tpBound(size_t(64), nextPowerOfTwo(matrixSize*8), size_t(1024)), nextPowerOfTwo(imageSize));
+  };
 
-      for(size_t j=r+1; j<h-r; j++)
+  if(width<1 || height<1 || (width*height)>matrixData.size())
+    return;
+
+  FFT2D_lt fft2D(tileSize(width, srcWidth), tileSize(height, srcHeight));
+  auto spectrum = kernelSpectrum(cache, fft2D, matrixData, width, height);
+
+  size_t fw = fft2D.width;
+  size_t fh = fft2D.height;
+  size_t stepX = fw - (width-1);
+  size_t stepY = fh - (height-1);
+  size_t tilesX = (dw+stepX-1) / stepX;
+  size_t tilesY = (dh+stepY-1) / stepY;
+  size_t tiles = tilesX*tilesY;
+
+  std::atomic<size_t> c{0};
+  tp_utils::parallel([&](auto /*locker*/)
+  {
+    std::vector<std::complex<double>> tile(fw*fh);
+    std::vector<std::complex<double>> column;
+
+    for(size_t t=c++; t<tiles; t=c++)
+    {
+      size_t x0 = (t%tilesX)*stepX;
+      size_t y0 = (t/tilesX)*stepY;
+      size_t sw = tpMin(fw, srcWidth-x0);
+      size_t sh = tpMin(fh, srcHeight-y0);
+      size_t tw = tpMin(stepX, dw-x0);
+      size_t th = tpMin(stepY, dh-y0);
+
+      for(size_t ch=0; ch<activeChannels; ch+=2)
       {
-        val += scl[ri] - scl[li];
-        tcl[ti] = val*iarr;
-        li += w;
-        ri += w;
-        ti += w;
+        bool pair = (ch+1)<activeChannels;
+
+        std::fill(tile.begin(), tile.end(), std::complex<double>());
+        for(size_t y=0; y<sh; y++)
+        {
+          const uint8_t* s = src + ((((y0+y)*srcWidth)+x0)*channels) + ch;
+          std::complex<double>* d = tile.data() + (y*fw);
+          for(size_t x=0; x<sw; x++, s+=channels)
+            d[x] = std::complex<double>(s[0], pair?s[1]:0);
+        }
+
+        fft2D.transform(tile.data(), column, false);
+        for(size_t i=0; i<tile.size(); i++)
+          tile[i] *= (*spectrum)[i];
+        fft2D.transform(tile.data(), column, true);
+
+        for(size_t y=0; y<th; y++)
+        {
+          uint8_t* d = dst + ((((y0+y)*dw)+x0)*channels) + ch;
+          const std::complex<double>* s = tile.data() + (y*fw);
+          for(size_t x=0; x<tw; x++, d+=channels)
+          {
+            d[0] = uint8_t(tpBound(0.0, s[x].real()+fftRoundingBias, 255.0));
+            if(pair)
+              d[1] = uint8_t(tpBound(0.0, s[x].imag()+fftRoundingBias, 255.0));
+          }
+        }
       }
+    }
+  });
+}
+
+//##################################################################################################
+//! Output tiles of convolvePadded, a row of a tile is 4KB.
+constexpr size_t paddedTileWidth=256;
+constexpr size_t paddedTileHeight=32;
 
-      for(size_t j=h-r; j<h; j++)
+//##################################################################################################
+constexpr std::array<double, 9> blur3Matrix
+{
+  1, 3, 1,
+  3, 5, 3,
+  1, 3, 1
+};
+
+//##################################################################################################
+constexpr std::array<double, 25> blur5Matrix
+{
+  0, 0, 1, 0, 0,
+  0, 1, 3, 1, 0,
+  1, 3, 5, 3, 1,
+  0, 1, 3, 1, 0,
+  0, 0, 1, 0, 0
+};
+
+//##################################################################################################
+//! The float weights of a preset after divideBySize(), matching matrixDataF() exactly.
+template<size_t N>
+constexpr std::array<float, N> presetValues(const std::array<double, N>& matrix)
+{
+  double f = 1.0 / double(N);
+  std::array<float, N> values{};
+  for(size_t i=0; i<N; i++)
+    values[i] = float(matrix[i] * f);
+  return values;
+}
+
+//##################################################################################################
+struct Blur3Preset_lt
+{
+  static constexpr size_t width=3;
+  static constexpr size_t height=3;
+  static constexpr std::array<float, 9> values = presetValues(blur3Matrix);
+};
+
+//##################################################################################################
+struct Blur5Preset_lt
+{
+  static constexpr size_t width=5;
+  static constexpr size_t height=5;
+  static constexpr std::array<float, 25> values = presetValues(blur5Matrix);
+};
+
+//##################################################################################################
+//! Weights of a preset matrix known at compile time, zero weights are removed.
+template<typename Preset>
+struct PresetWeights_lt
+{
+  static constexpr size_t width=Preset::width;
+  static constexpr size_t height=Preset::height;
+
+  //################################################################################################
+  template<size_t I>
+  void accumulate(glm::vec4& p, const glm::vec4& v)const
+  {
+    if constexpr(Preset::values[I]!=0.0f)
+      p += v * Preset::values[I];
+  }
+
+  //################################################################################################
+  static bool matches(const std::vector<float>& matrixData, size_t width_, size_t height_)
+  {
+    return width_==width && height_==height && matrixData.size()==Preset::values.size() &&
+        std::equal(matrixData.begin(), matrixData.end(), Preset::values.begin());
+  }
+};
+
+//##################################################################################################
+//! Weights of a matrix with a size known at compile time.
+template<size_t W, size_t H>
+struct FixedSizeWeights_lt
+{
+  static constexpr size_t width=W;
+  static constexpr size_t height=H;
+  std::array<float, W*H> values;
+
+  //################################################################################################
+  FixedSizeWeights_lt(const std::vector<float>& matrixData)
+  {
+    std::copy(matrixData.begin(), matrixData.begin()+(W*H), values.begin());
+  }
+
+  //################################################################################################
+  template<size_t I>
+  void accumulate(glm::vec4& p, const glm::vec4& v)const
+  {
+    p += v * values[I];
+  }
+};
+
+//##################################################################################################
+//! Apply every tap of a compile time matrix to tw pixels of a row.
+template<typename Weights, size_t... I>
+void convolveTileRow(const Weights& weights,
+                     const glm::vec4* src,
+                     size_t srcWidth,
+                     glm::vec4* dst,
+                     size_t tw,
+                     std::index_sequence<I...>)
+{
+  for(size_t x=0; x<tw; x++, src++)
+  {
+    glm::vec4 p{0.0f,0.0f,0.0f,0.0f};
+    (weights.template accumulate<I>(p, src[((I/Weights::width)*srcWidth) + (I%Weights::width)]), ...);
+    dst[x] = p;
+  }
+}
+
+//##################################################################################################
+template<typename Weights>
+void convolvePaddedFixedSize(const Weights& weights,
+                             const tp_image_utils::ColorMapF& src,
+                             tp_image_utils::ColorMapF& dst,
+                             size_t dw,
+                             size_t dh)
+{
+  size_t marginX = (Weights::width-1)/2;
+  size_t marginY = (Weights::height-1)/2;
+
+  size_t tilesX = (dw+paddedTileWidth-1) / paddedTileWidth;
+  size_t tilesY = (dh+paddedTileHeight-1) / paddedTileHeight;
+  size_t tiles = tilesX*tilesY;
+
+  std::atomic<size_t> c{0};
+  tp_utils::parallel([&](auto /*locker*/)
+  {
+    for(size_t t=c++; t<tiles; t=c++)
+    {
+      size_t x0 = (t%tilesX)*paddedTileWidth;
+      size_t y0 = (t/tilesX)*paddedTileHeight;
+      size_t tw = tpMin(paddedTileWidth,  dw-x0);
+      size_t th = tpMin(paddedTileHeight, dh-y0);
+
+      for(size_t y=0; y<th; y++)
       {
-        val += lv-scl[li];
-        tcl[ti] = val*iarr;
-        li += w;
-        ti += w;
+        const glm::vec4* s = src.constData() + ((y0+y)*src.width()) + x0;
+        glm::vec4* d = dst.data() + ((y0+y+marginY)*dst.width()) + marginX + x0;
+        convolveTileRow(weights, s, src.width(), d, tw, std::make_index_sequence<Weights::width*Weights::height>());
       }
     }
   });
 }
 
 //##################################################################################################
-void boxBlur_4(glm::vec3* scl, glm::vec3* tcl, size_t w, size_t h, size_t r)
+//! Apply presets and small matrices using unrolled taps, returns false for other matrices.
+bool convolvePaddedSpecialized(const tp_image_utils::ColorMapF& src,
+                               tp_image_utils::ColorMapF& dst,
+                               const std::vector<float>& matrixData,
+                               size_t width,
+                               size_t height,
+                               size_t dw,
+                               size_t dh)
 {
-  std::memcpy(tcl, scl, sizeof(glm::vec3)*w*h);
-  boxBlurH_4(tcl, scl, w, h, r);
-  boxBlurT_4(scl, tcl, w, h, r);
+  if(PresetWeights_lt<Blur3Preset_lt>::matches(matrixData, width, height))
+    convolvePaddedFixedSize(PresetWeights_lt<Blur3Preset_lt>(), src, dst, dw, dh);
+
+  else if(PresetWeights_lt<Blur5Preset_lt>::matches(matrixData, width, height))
+    convolvePaddedFixedSize(PresetWeights_lt<Blur5Preset_lt>(), src, dst, dw, dh);
+
+  else if(width==3 && height==3)
+    convolvePaddedFixedSize(FixedSizeWeights_lt<3, 3>(matrixData), src, dst, dw, dh);
+
+  else if(width==3 && height==5)
+    convolvePaddedFixedSize(FixedSizeWeights_lt<3, 5>(matrixData), src, dst, dw, dh);
+
+  else if(width==5 && height==3)
+    convolvePaddedFixedSize(FixedSizeWeights_lt<5, 3>(matrixData), src, dst, dw, dh);
+
+  else if(width==5 && height==5)
+    convolvePaddedFixedSize(FixedSizeWeights_lt<5, 5>(matrixData), src, dst, dw, dh);
+
+  else
+    return false;
+
+  return true;
 }
 
 //##################################################################################################
-void gaussBlur_4(glm::vec3* scl, glm::vec3* tcl, size_t w, size_t h, size_t r)
+template<typename ImageType>
+void makeOpaque(ImageType& image)
 {
-  std::vector<size_t> bxs = boxesForGauss(float(r), 3);
-  boxBlur_4(scl, tcl, w, h, (bxs[0] - 1) / 2);
-  boxBlur_4(tcl, scl, w, h, (bxs[1] - 1) / 2);
-  boxBlur_4(scl, tcl, w, h, (bxs[2] - 1) / 2);
+  if constexpr(std::is_same_v<ImageType, tp_image_utils::ColorMap>)
+  {
+    TPPixel* d = image.data();
+    TPPixel* dMax = d + (image.width()*image.height());
+    for(; d<dMax; d++)
+      d->a = 255;
+  }
+  else if constexpr(std::is_same_v<ImageType, tp_image_utils::ColorMapF>)
+  {
+    glm::vec4* d = image.data();
+    glm::vec4* dMax = d + (image.width()*image.height());
+    for(; d<dMax; d++)
+      d->w = 1.0f;
+  }
 }
 
+//##################################################################################################
+template<typename ImageType>
+ImageType convolveImage(const ImageType& src,
+                        const std::vector<double>& matrixData,
+                        size_t width,
+                        size_t height,
+                        const std::vector<double>& row,
+                        const std::vector<double>& column,
+                        KernelSpectrumCache_lt& cache)
+{
+  if(width<1 || height<1 || (width*height)>matrixData.size())
+    return ImageType();
+
+  size_t dw = src.width()  - (width-1);
+  size_t dh = src.height() - (height-1);
+
+  if(dw<1 || dh<1 || dw>src.width() || dh>src.height())
+    return ImageType();
+
+  constexpr size_t channels = sizeof(*src.constData());
+
+  ImageType dst(dw, dh);
+  if(row.empty() && (width*height)>=fftMatrixSize)
+    convolveBytesFFT(reinterpret_cast<const uint8_t*>(src.constData()),
+                     src.width(),
+                     src.height(),
+                     channels,
+                     tpMin(channels, size_t(3)),
+                     reinterpret_cast<uint8_t*>(dst.data()),
+                     dw,
+                     dh,
+                     matrixData,
+                     width,
+                     height,
+                     cache);
+  else
+    convolveBytes(reinterpret_cast<const uint8_t*>(src.constData()),
+                  src.width(),
+                  channels,
+                  reinterpret_cast<uint8_t*>(dst.data()),
+                  dw,
+                  dh,
+                  matrixData,
+                  width,
+                  height,
+                  row,
+                  column);
+
+  makeOpaque(dst);
+  return dst;
 }
 
+//##################################################################################################
+template<typename ImageType>
+ImageType convolveMatrixData(const ImageType& src, const std::vector<double>& matrixData, size_t width, size_t height)
+{
+  if(width<=1 || height<=1)
+    return ImageType();
+
+  if((width*height)>matrixData.size())
+    return ImageType();
+
+  std::vector<double> row;
+  std::vector<double> column;
+  if(!separate(matrixData, width, height, row, column))
+  {
+    row.clear();
+    column.clear();
+  }
+
+  KernelSpectrumCache_lt cache;
+  return convolveImage(src, matrixData, width, height, row, column, cache);
+}
 
 
+//##################################################################################################
+//! Apply several matrices with one traversal of the source rows
+/*!
+Matrices that would use the FFT, a copy, or 64 bit accumulators are applied on their own, the rest
+share bands of source rows so each row is read from memory once for all matrices.
+*/
+template<typename ImageType>
+std::vector<ImageType> convolveBank(const ImageType& src, const std::vector<ConvolutionMatrix>& matrices)
+{
+  constexpr size_t channels = sizeof(*src.constData());
+
+  struct Entry_lt
+  {
+    uint8_t* dst{nullptr};
+    size_t n{0};
+    size_t dh{0};
+    size_t width{0};
+    size_t height{0};
+    bool separable{false};
+    FixedWeights_lt<int32_t> matrix;
+    SeparableWeights_lt<int32_t> separableWeights;
+  };
+
+  std::vector<ImageType> results(matrices.size());
+  std::vector<Entry_lt> entries;
+  size_t maxDh=0;
+
+  for(size_t i=0; i<matrices.size(); i++)
+  {
+    const ConvolutionMatrix& m = matrices.at(i);
+
+    if(m.width()<1 || m.height()<1 || (m.width()*m.height())>m.matrixData().size())
+      continue;
+
+    size_t dw = src.width()  - (m.width()-1);
+    size_t dh = src.height() - (m.height()-1);
+
+    if(dw<1 || dh<1 || dw>src.width() || dh>src.height())
+      continue;
+
+    Entry_lt entry;
+    entry.n = dw*channels;
+    entry.dh = dh;
+    entry.width = m.width();
+    entry.height = m.height();
+    entry.separable = m.isSeparable();
+
+    bool shared = unitWeightIndex(m.matrixData())==m.matrixData().size();
+    if(shared && entry.separable)
+      shared = separableWeights(m.rowData(), m.columnData(), 24, entry.separableWeights);
+    else if(shared)
+    {
+      int shift = fixedShift<int32_t>(m.matrixData(), 255.0, 24);
+      shared = shift>=8 && (m.width()*m.height())<fftMatrixSize;
+      entry.matrix = quantizeWeights<int32_t>(m.matrixData(), shift);
+    }
+
+    if(!shared)
+    {
+      results[i] = m.convolve(src);
+      continue;
+    }
+
+    results[i] = ImageType(dw, dh);
+    entry.dst = reinterpret_cast<uint8_t*>(results[i].data());
+    maxDh = tpMax(maxDh, dh);
+    entries.push_back(std::move(entry));
+  }
+
+  if(!entries.empty())
+  {
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(src.constData());
+    size_t srcStride = src.width()*channels;
+    size_t bands = (maxDh+bandHeight-1) / bandHeight;
+
+    std::atomic<size_t> c{0};
+    tp_utils::parallel([&](auto /*locker*/)
+    {
+      std::vector<std::vector<int32_t>> rows(entries.size());
+      for(size_t e=0; e<entries.size(); e++)
+        if(entries.at(e).separable)
+          rows.at(e).resize(entries.at(e).n*entries.at(e).height);
+
+      std::vector<int32_t> acc(accBlockSize);
+
+      auto filter = [&](size_t e, size_t y)
+      {
+        const Entry_lt& entry = entries.at(e);
+        int32_t* d = rows.at(e).data() + ((y%entry.height)*entry.n);
+        filterRow(s+(y*srcStride), channels, entry.n, entry.separableWeights.row, entry.separableWeights.downShift, d);
+      };
+
+      for(size_t band=c++; band<bands; band=c++)
+      {
+        size_t y0 = band*bandHeight;
+        size_t y1 = tpMin(y0+bandHeight, maxDh);
+
+        for(size_t e=0; e<entries.size(); e++)
+          if(entries.at(e).separable && y0<entries.at(e).dh)
+            for(size_t y=y0; y<(y0+entries.at(e).height-1); y++)
+              filter(e, y);
+
+        for(size_t y=y0; y<y1; y++)
+        {
+          for(size_t e=0; e<entries.size(); e++)
+          {
+            const Entry_lt& entry = entries.at(e);
+            if(y>=entry.dh)
+              continue;
+
+            uint8_t* d = entry.dst + (y*entry.n);
+            if(entry.separable)
+            {
+              filter(e, y+entry.height-1);
+              combineRows(rows.at(e).data(), y, entry.n, entry.separableWeights.column, entry.separableWeights.outputShift, acc.data(), d);
+            }
+            else
+              convolveRow(s+(y*srcStride), srcStride, channels, entry.n, entry.matrix, entry.width, entry.height, acc.data(), d);
+          }
+        }
+      }
+    });
+
+    for(ImageType& result : results)
+      makeOpaque(result);
+  }
+
+  return results;
+}
+}
+
+
+
+//##################################################################################################
+struct ConvolutionMatrix::FFTCache : public KernelSpectrumCache_lt
+{
+
+};
+
 //##################################################################################################
 ConvolutionMatrix::ConvolutionMatrix()
 {
@@ -229,6 +1107,7 @@ void ConvolutionMatrix::setMatrixData(const std::vector<double>& matrixData, siz
     m_width = width;
     m_height = height;
     m_matrixData = matrixData;
+    matrixChanged();
   }
 }
 
@@ -305,12 +1184,24 @@ void ConvolutionMatrix::loadString(const std::string& text)
 
     }
   }
+
+  matrixChanged();
 }
 
 //##################################################################################################
 tp_image_utils::ColorMap ConvolutionMatrix::convolve(const tp_image_utils::ColorMap& src)const
 {
-  return convolutionMatrix(src, m_matrixData, m_width, m_height);
+  //A moved from matrix has no cache so it uses a temporary one.
+  FFTCache cache;
+  return convolveImage(src, m_matrixData, m_width, m_height, m_rowData, m_columnData, m_fftCache?*m_fftCache:cache);
+}
+
+//##################################################################################################
+tp_image_utils::ByteMap ConvolutionMatrix::convolve(const tp_image_utils::ByteMap& src)const
+{
+  //A moved from matrix has no cache so it uses a temporary one.
+  FFTCache cache;
+  return convolveImage(src, m_matrixData, m_width, m_height, m_rowData, m_columnData, m_fftCache?*m_fftCache:cache);
 }
 
 //##################################################################################################
@@ -335,12 +1226,7 @@ void ConvolutionMatrix::makeBlur3()
   m_width =  3;
   m_height = 3;
 
-  m_matrixData =
-  {
-    1, 3, 1,
-    3, 5, 3,
-    1, 3, 1
-  };
+  m_matrixData.assign(blur3Matrix.begin(), blur3Matrix.end());
 
   divideBySize();
 }
@@ -351,14 +1237,7 @@ void ConvolutionMatrix::makeBlur5()
   m_width =  5;
   m_height = 5;
 
-  m_matrixData =
-  {
-    0, 0, 1, 0, 0,
-    0, 1, 3, 1, 0,
-    1, 3, 5, 3, 1,
-    0, 1, 3, 1, 0,
-    0, 0, 1, 0, 0
-  };
+  m_matrixData.assign(blur5Matrix.begin(), blur5Matrix.end());
 
   divideBySize();
 }
@@ -369,84 +1248,73 @@ void ConvolutionMatrix::divideBySize()
   double f = 1.0 / (double(m_width) * double(m_height));
   for(double& v : m_matrixData)
     v *= f;
+
+  matrixChanged();
 }
 
-namespace
-{
 //##################################################################################################
-struct PixelDetails_lt
+bool ConvolutionMatrix::isSeparable()const
 {
-  double red  {0.0};
-  double green{0.0};
-  double blue {0.0};
-};
+  return m_separable;
 }
 
 //##################################################################################################
-tp_image_utils::ColorMap convolutionMatrix(const tp_image_utils::ColorMap& src, const std::vector<double>& matrixData, size_t width, size_t height)
+const std::vector<double>& ConvolutionMatrix::rowData()const
 {
-  if(width<=1 || height<=1)
-    return tp_image_utils::ColorMap();
-
-  if((width*height)>matrixData.size())
-    return tp_image_utils::ColorMap();
-
-  size_t dw = src.width()  - (width-1);//((width+1)/2);
-  size_t dh = src.height() - (height-1);//((height+1)/2);
-
-  if(dw<1 || dh<1 || dw>src.width() || dh>src.height())
-    return tp_image_utils::ColorMap();
+  return m_rowData;
+}
 
-  std::vector<PixelDetails_lt> buffer;
-  buffer.resize(dw*dh);
+//##################################################################################################
+const std::vector<double>& ConvolutionMatrix::columnData()const
+{
+  return m_columnData;
+}
 
-  PixelDetails_lt* bufferData = buffer.data();
+//##################################################################################################
+void ConvolutionMatrix::matrixChanged()
+{
+  m_fftCache = std::make_shared<FFTCache>();
 
-  for(size_t my=0; my<height; my++)
+  m_separable = separate(m_matrixData, m_width, m_height, m_rowData, m_columnData);
+  if(!m_separable)
   {
-    for(size_t mx=0; mx<width;  mx++)
-    {
-      double weight = matrixData.at((my*width)+mx);
-      for(size_t dy=0; dy<dh; dy++)
-      {
-        auto* s = src.constData() + ((dy+my)*src.width()) + mx;
-        PixelDetails_lt* d = bufferData + (dy*dw);
-        PixelDetails_lt* dMax = d + dw;
-        while(d<dMax)
-        {
-          d->red   += double(s->r) * weight;
-          d->green += double(s->g) * weight;
-          d->blue  += double(s->b) * weight;
-
-          d++;
-          s++;
-        }
-      }
-    }
+    m_rowData.clear();
+    m_columnData.clear();
   }
+}
 
-  tp_image_utils::ColorMap dst(dw, dh);
-  {
-    PixelDetails_lt* s = bufferData;
+//##################################################################################################
+bool separateMatrix(const std::vector<double>& matrixData,
+                    size_t width,
+                    size_t height,
+                    std::vector<double>& row,
+                    std::vector<double>& column)
+{
+  return separate(matrixData, width, height, row, column);
+}
 
-    for(size_t y=0; y<dh; y++)
-    {
-      TPPixel* d = dst.data() + (y*dw);
-      TPPixel* dMax = d+dw;
+//##################################################################################################
+tp_image_utils::ColorMap convolutionMatrix(const tp_image_utils::ColorMap& src, const std::vector<double>& matrixData, size_t width, size_t height)
+{
+  return convolveMatrixData(src, matrixData, width, height);
+}
 
-      while(d<dMax)
-      {
-        d->r = uint8_t(tpBound(0, int(s->red  ), 255));
-        d->g = uint8_t(tpBound(0, int(s->green), 255));
-        d->b = uint8_t(tpBound(0, int(s->blue ), 255));
-        d->a = 255;
-        d++;
-        s++;
-      }
-    }
-  }
+//##################################################################################################
+tp_image_utils::ByteMap convolutionMatrix(const tp_image_utils::ByteMap& src, const std::vector<double>& matrixData, size_t width, size_t height)
+{
+  return convolveMatrixData(src, matrixData, width, height);
+}
 
-  return dst;
+//##################################################################################################
+std::vector<tp_image_utils::ColorMap> convolutionMatrices(const tp_image_utils::ColorMap& src, const std::vector<ConvolutionMatrix>& matrices)
+{
+  return convolveBank(src, matrices);
+}
+
+//##################################################################################################
+std::vector<tp_image_utils::ByteMap> convolutionMatrices(const tp_image_utils::ByteMap& src, const std::vector<ConvolutionMatrix>& matrices)
+{
+  return convolveBank(src, matrices);
 }
 
 //##################################################################################################
@@ -469,29 +1337,82 @@ tp_image_utils::ColorMapF convolvePadded(const tp_image_utils::ColorMapF& src, c
 
   tp_image_utils::ColorMapF dst{src.width(), src.height(), nullptr, {0.0f,0.0f,0.0f,0.0f}};
   glm::vec4* bufferData = dst.data();
-  for(size_t my=0; my<height; my++)
+
+  std::vector<float> row;
+  std::vector<float> column;
+  bool separable = separate(matrixData, width, height, row, column);
+
+  if(separable || !convolvePaddedSpecialized(src, dst, matrixData, width, height, dw, dh))
   {
-    for(size_t mx=0; mx<width;  mx++)
+    //Each tile of output is calculated with all taps while its source rows are in cache.
+    size_t tilesX = (dw+paddedTileWidth-1) / paddedTileWidth;
+    size_t tilesY = (dh+paddedTileHeight-1) / paddedTileHeight;
+    size_t tiles = tilesX*tilesY;
+
+    std::atomic<size_t> c{0};
+    tp_utils::parallel([&](auto /*locker*/)
     {
-      float weight = matrixData.at((my*width)+mx);
-      std::atomic<size_t> dyCounter{0};
-      tp_utils::parallel([&](auto /*locker*/)
-      {
-        for(;;)
-        {
-          size_t const dy = dyCounter++;
+      //The horizontal pass of a separable matrix for the rows of a tile and its halo.
+      std::vector<glm::vec4> rows;
+      if(separable)
+        rows.resize((paddedTileHeight+height-1)*paddedTileWidth);
 
-          if(dy>=dh)
-            return;
+      for(size_t t=c++; t<tiles; t=c++)
+      {
+        size_t x0 = (t%tilesX)*paddedTileWidth;
+        size_t y0 = (t/tilesX)*paddedTileHeight;
+        size_t tw = tpMin(paddedTileWidth,  dw-x0);
+        size_t th = tpMin(paddedTileHeight, dh-y0);
 
-          auto* s = src.constData() + ((dy+my)*src.width()) + mx;
-          glm::vec4* d = bufferData + ((dy+marginY)*dst.width()) + marginX;
-          glm::vec4* dMax = d + dw;
-          for(; d<dMax; d++, s++)
-            (*d) += (*s) * weight;
+        if(separable)
+        {
+          for(size_t r=0; r<(th+height-1); r++)
+          {
+            const glm::vec4* s = src.constData() + ((y0+r)*src.width()) + x0;
+            glm::vec4* d = rows.data() + (r*paddedTileWidth);
+            for(size_t x=0; x<tw; x++)
+            {
+              glm::vec4 p{0.0f,0.0f,0.0f,0.0f};
+              for(size_t mx=0; mx<width; mx++)
+                p += s[x+mx] * row[mx];
+              d[x] = p;
+            }
+          }
+
+          for(size_t y=0; y<th; y++)
+          {
+            glm::vec4* d = bufferData + ((y0+y+marginY)*dst.width()) + marginX + x0;
+            for(size_t x=0; x<tw; x++)
+            {
+              const glm::vec4* s = rows.data() + (y*paddedTileWidth) + x;
+              glm::vec4 p{0.0f,0.0f,0.0f,0.0f};
+              for(size_t my=0; my<height; my++, s+=paddedTileWidth)
+                p += (*s) * column[my];
+              d[x] = p;
+            }
+          }
         }
-      });
-    }
+        else
+        {
+          for(size_t y=0; y<th; y++)
+          {
+            glm::vec4* d = bufferData + ((y0+y+marginY)*dst.width()) + marginX + x0;
+            glm::vec4* dMax = d + tw;
+            const float* w = matrixData.data();
+            for(size_t my=0; my<height; my++)
+            {
+              for(size_t mx=0; mx<width; mx++, w++)
+              {
+                float weight = *w;
+                const glm::vec4* s = src.constData() + ((y0+y+my)*src.width()) + x0 + mx;
+                for(glm::vec4* dd=d; dd<dMax; dd++, s++)
+                  (*dd) += (*s) * weight;
+              }
+            }
+          }
+        }
+      }
+    });
   }
 
   // Copy in the top and bottom margins
@@ -506,7 +1427,7 @@ tp_image_utils::ColorMapF convolvePadded(const tp_image_utils::ColorMapF& src, c
   {
     size_t xSize = marginX*sizeof(glm::vec4);
     size_t x1 = 0;
-    size_t x2 = (dst.width()-1) - marginX;
+    size_t x2 = dst.width() - marginX;
 
     size_t yMax = dst.height() - marginY;
 
@@ -527,87 +1448,89 @@ void gaussBlur(glm::vec3* source,
                size_t h,
                size_t radius)
 {
-  gaussBlur_4(source, target, w, h, radius);
+  static_assert(sizeof(glm::vec3)==3*sizeof(float), "glm::vec3 must be 3 packed floats.");
+  std::memcpy(target, source, sizeof(glm::vec3)*w*h);
+  gaussBlurBoxes<float, 3>(reinterpret_cast<float*>(target), reinterpret_cast<float*>(source), w, h, radius);
 }
 
 //##################################################################################################
-tp_image_utils::ColorMap gaussBlur(const tp_image_utils::ColorMap& source, size_t radius)
+tp_image_utils::ColorMap gaussBlur(const tp_image_utils::ColorMap& source, size_t radius, bool blurAlpha)
 {
-  //std::vector<glm::vec3> in(source.size(), glm::vec3(0.0f,0.0f,0.0f));
-  std::unique_ptr<glm::vec3[]> in( new glm::vec3[source.size()]);
-  std::unique_ptr<glm::vec3[]> out( new glm::vec3[source.size()]);
+  static_assert(sizeof(TPPixel)==4, "TPPixel must be 4 packed bytes.");
 
-  {
-    auto d = in.get();
-    auto s = source.constData();
-    auto sMax = s+source.size();
+  tp_image_utils::ColorMap result = source;
+  std::vector<uint8_t> aux(source.size()*4);
+  gaussBlurBoxes<uint8_t, 4>(reinterpret_cast<uint8_t*>(result.data()), aux.data(), source.width(), source.height(), radius);
 
-    for(; s<sMax; s++, d++)
-    {
-      d->x = s->r;
-      d->y = s->g;
-      d->z = s->b;
-    }
-  }
+  if(!blurAlpha)
+    makeOpaque(result);
 
-  gaussBlur(in.get(), out.get(), source.width(), source.height(), radius);
+  return result;
+}
 
-  tp_image_utils::ColorMap result(source.width(), source.height());
-  {
-    auto d = result.data();
-    auto s = out.get();
-    auto sMax = s+source.size();
+//##################################################################################################
+tp_image_utils::ColorMapF gaussBlur(const tp_image_utils::ColorMapF& source, size_t radius, bool blurAlpha)
+{
+  static_assert(sizeof(glm::vec4)==4*sizeof(float), "glm::vec4 must be 4 packed floats.");
 
-    for(; s<sMax; s++, d++)
-    {
-      d->r = uint8_t(s->x);
-      d->g = uint8_t(s->y);
-      d->b = uint8_t(s->z);
-      d->a = 255;
-    }
-  }
+  tp_image_utils::ColorMapF result = source;
+  std::vector<float> aux(source.size()*4);
+  gaussBlurBoxes<float, 4>(&result.data()->x, aux.data(), source.width(), source.height(), radius);
+
+  if(!blurAlpha)
+    makeOpaque(result);
 
   return result;
 }
 
 //##################################################################################################
-tp_image_utils::ColorMapF gaussBlur(const tp_image_utils::ColorMapF& source, size_t radius)
+tp_image_utils::ByteMap gaussBlur(const tp_image_utils::ByteMap& source, size_t radius)
 {
-  std::unique_ptr<glm::vec3[]> in( new glm::vec3[source.size()]);
-  std::unique_ptr<glm::vec3[]> out( new glm::vec3[source.size()]);
+  tp_image_utils::ByteMap result = source;
+  std::vector<uint8_t> aux(source.size());
+  gaussBlurBoxes<uint8_t, 1>(result.data(), aux.data(), source.width(), source.height(), radius);
+  return result;
+}
 
-  {
-    auto d = in.get();
-    auto s = source.constData();
-    auto sMax = s+source.size();
+//##################################################################################################
+tp_image_utils::ColorMap gaussBlur(const tp_image_utils::ColorMap& source, float sigma, GaussBlurMode mode, bool blurAlpha)
+{
+  if(mode == GaussBlurMode::Boxes)
+    return gaussBlur(source, size_t(std::lround(tpMax(sigma, 0.0f))), blurAlpha);
 
-    for(; s<sMax; s++, d++)
-    {
-      d->x = s->x;
-      d->y = s->y;
-      d->z = s->z;
-    }
-  }
+  tp_image_utils::ColorMap result = source;
+  gaussBlurRecursive<uint8_t, 4>(reinterpret_cast<uint8_t*>(result.data()), source.width(), source.height(), sigma);
 
-  gaussBlur(in.get(), out.get(), source.width(), source.height(), radius);
+  if(!blurAlpha)
+    makeOpaque(result);
 
-  tp_image_utils::ColorMapF result(source.width(), source.height());
-  {
-    auto d = result.data();
-    auto s = out.get();
-    auto sMax = s+source.size();
+  return result;
+}
 
-    for(; s<sMax; s++, d++)
-    {
-      d->x = s->x;
-      d->y = s->y;
-      d->z = s->z;
-      d->w = 1.0f;
-    }
-  }
+//##################################################################################################
+tp_image_utils::ColorMapF gaussBlur(const tp_image_utils::ColorMapF& source, float sigma, GaussBlurMode mode, bool blurAlpha)
+{
+  if(mode == GaussBlurMode::Boxes)
+    return gaussBlur(source, size_t(std::lround(tpMax(sigma, 0.0f))), blurAlpha);
+
+  tp_image_utils::ColorMapF result = source;
+  gaussBlurRecursive<float, 4>(&result.data()->x, source.width(), source.height(), sigma);
+
+  if(!blurAlpha)
+    makeOpaque(result);
 
   return result;
+}
+
+//##################################################################################################
+tp_image_utils::ByteMap gaussBlur(const tp_image_utils::ByteMap& source, float sigma, GaussBlurMode mode)
+{
+  if(mode == GaussBlurMode::Boxes)
+    return gaussBlur(source, size_t(std::lround(tpMax(sigma, 0.0f))));
 
+  tp_image_utils::ByteMap result = source;
+  gaussBlurRecursive<uint8_t, 1>(result.data(), source.width(), source.height(), sigma);
+  return result;
 }
 
 //##################################################################################################
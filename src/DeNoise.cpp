@@ -2,13 +2,258 @@
 
 #include "tp_utils/DebugUtils.h"
 
-#include <memory.h>
+#include "PrivateUtils.h"
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <cmath>
 
 namespace tp_image_utils_functions
 {
 
+namespace
+{
+using Parent_lt = std::atomic<int>;
+
+//##################################################################################################
+//! Join the sets of two labels from a single thread and return the root of the joined set.
+int uniteLocal(Parent_lt* parent, int a, int b)
+{
+  a = findRoot(parent, a);
+  b = findRoot(parent, b);
+
+  if(a<b)
+    std::swap(a, b);
+
+  parent[a].store(b, std::memory_order_relaxed);
+  return b;
+}
+
+//##################################################################################################
+//! Join the sets of two labels, this is safe to call from several threads at the same time.
+/*!
+The larger root is linked below the smaller one with a compare and swap, if another thread changed
+the root first the roots are found again and the link is retried.
+*/
+void unite(Parent_lt* parent, int a, int b)
+{
+  for(;;)
+  {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+
+    if(a==b)
+      return;
+
+    if(a<b)
+      std::swap(a, b);
+
+    int expected = a;
+    if(parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+      return;
+  }
+}
+
 //##################################################################################################
-ByteRegions::ByteRegions(const tp_image_utils::ByteMap& src, bool addCorners)
+//! Give each pixel in rows y0 to y1 a label copied from a matching neighbour above or to the left.
+/*!
+Pixels that do not match any neighbour start a new label, labels are numbered in raster order from
+the index of the first pixel of the strip. Rows above y0 are not looked at, strips are joined by
+joinStrips().
+
+\return The number of labels created.
+*/
+size_t labelStrip(const uint8_t* s, int* m, Parent_lt* parent, size_t w, size_t y0, size_t y1, bool addCorners)
+{
+  int next = int(y0*w);
+  auto newLabel = [&]
+  {
+    parent[next].store(next, std::memory_order_relaxed);
+    return next++;
+  };
+
+  for(size_t y=y0; y<y1; y++)
+  {
+    const uint8_t* sRow = s + y*w;
+    int* mRow = m + y*w;
+
+    if(y==y0)
+    {
+      mRow[0] = newLabel();
+      for(size_t x=1; x<w; x++)
+        mRow[x] = (sRow[x]==sRow[x-1])?mRow[x-1]:newLabel();
+      continue;
+    }
+
+    const uint8_t* sUp = sRow - w;
+    const int* mUp = mRow - w;
+
+    for(size_t x=0; x<w; x++)
+    {
+      uint8_t v = sRow[x];
+      bool l = (x>0 && sRow[x-1]==v);
+      bool u = (sUp[x]==v);
+
+      if(!addCorners)
+      {
+        if(u && l)
+          mRow[x] = uniteLocal(parent, mUp[x], mRow[x-1]);
+        else if(u)
+          mRow[x] = mUp[x];
+        else if(l)
+          mRow[x] = mRow[x-1];
+        else
+          mRow[x] = newLabel();
+        continue;
+      }
+
+      // With corners the left, up left, and up right neighbours all touch the pixel above, so if
+      // that matches everything is already joined.
+      if(u)
+      {
+        mRow[x] = mUp[x];
+        continue;
+      }
+
+      bool ul = (x>0 && sUp[x-1]==v);
+      bool ur = (x+1<w && sUp[x+1]==v);
+
+      if(ur)
+      {
+        if(ul)
+          mRow[x] = uniteLocal(parent, mUp[x+1], mUp[x-1]);
+        else if(l)
+          mRow[x] = uniteLocal(parent, mUp[x+1], mRow[x-1]);
+        else
+          mRow[x] = mUp[x+1];
+      }
+      else if(ul)
+        mRow[x] = mUp[x-1];
+      else if(l)
+        mRow[x] = mRow[x-1];
+      else
+        mRow[x] = newLabel();
+    }
+  }
+
+  return size_t(next) - y0*w;
+}
+
+//##################################################################################################
+//! Join the labels of row y with matching neighbours in the row above, which is in another strip.
+void joinStrips(const uint8_t* s, const int* m, Parent_lt* parent, size_t w, size_t y, bool addCorners)
+{
+  const uint8_t* sRow = s + y*w;
+  const uint8_t* sUp = sRow - w;
+  const int* mRow = m + y*w;
+  const int* mUp = mRow - w;
+
+  // Runs of pixels share labels so only join pairs that differ from the last pair joined.
+  int lastA=-1;
+  int lastB=-1;
+  auto join = [&](int a, int b)
+  {
+    if(a==lastA && b==lastB)
+      return;
+    lastA = a;
+    lastB = b;
+    unite(parent, a, b);
+  };
+
+  for(size_t x=0; x<w; x++)
+  {
+    uint8_t v = sRow[x];
+
+    if(sUp[x]==v)
+      join(mRow[x], mUp[x]);
+
+    if(addCorners)
+    {
+      if(x>0 && sUp[x-1]==v)
+        join(mRow[x], mUp[x-1]);
+
+      if(x+1<w && sUp[x+1]==v)
+        join(mRow[x], mUp[x+1]);
+    }
+  }
+}
+
+//##################################################################################################
+//! Add a run of pixels x0 to x1-1 on row y to the bounding box and stats of a region.
+void addRunStats(ByteRegion& region,
+                 ByteRegionStats& stats,
+                 const uint8_t* s,
+                 size_t w,
+                 size_t h,
+                 size_t y,
+                 size_t x0,
+                 size_t x1)
+{
+  region.minX = std::min(region.minX, x0);
+  region.maxX = std::max(region.maxX, x1-1);
+  region.minY = std::min(region.minY, y);
+  region.maxY = std::max(region.maxY, y);
+
+  // Sums of x and x^2 over the run in closed form.
+  auto sumSquares = [](double k){return k*(k+1.0)*(2.0*k+1.0)/6.0;};
+  double n = double(x1-x0);
+  double dy = double(y);
+  double a = double(x0);
+  double b = double(x1-1);
+  double sx = (a+b)*n*0.5;
+
+  stats.m00 += n;
+  stats.m10 += sx;
+  stats.m01 += n*dy;
+  stats.m20 += sumSquares(b) - sumSquares(a-1.0);
+  stats.m11 += sx*dy;
+  stats.m02 += n*dy*dy;
+
+  // Runs are bounded by other values at both ends, above and below each pixel is checked.
+  const uint8_t* sRow = s + y*w;
+  uint8_t v = sRow[x0];
+  size_t perimeter = 2;
+  for(size_t x=x0; x<x1; x++)
+  {
+    if(y==0   || sRow[x-w]!=v)
+      perimeter++;
+    if(y+1==h || sRow[x+w]!=v)
+      perimeter++;
+  }
+  stats.perimeter += perimeter;
+}
+
+//##################################################################################################
+//! Part of a region found in a strip other than the one holding its root.
+struct Partial_lt
+{
+  size_t index{0};
+  ByteRegion region;
+  ByteRegionStats stats;
+};
+
+//##################################################################################################
+//! Call closure(strip) once for each strip using up to maxThreads threads.
+template<typename T>
+void forEachStrip(size_t nStrips, size_t maxThreads, const T& closure)
+{
+  parallelWorkers(maxThreads, nStrips, [&](const auto& next)
+  {
+    for(size_t i=next(); i<nStrips; i=next())
+      closure(i);
+  });
+}
+
+}
+
+//##################################################################################################
+ByteRegions::ByteRegions(const tp_image_utils::ByteMap& src,
+                         bool addCorners,
+                         bool calculateStats,
+                         size_t maxThreads)
 {
   w = src.width();
   h = src.height();
@@ -16,98 +261,247 @@ ByteRegions::ByteRegions(const tp_image_utils::ByteMap& src, bool addCorners)
   if(w<1 || h<1)
     return;
 
-  size_t ci=0;
-  regions.resize(w*h);
   map.resize(w*h);
-  int* done    = new int[w*h];
-  auto partial = new std::pair<int, int>[w*h*8];
-  size_t partialCount=0;
 
-  memset(done, 0, w*h*sizeof(int));
+  // The image is labeled in horizontal strips of at least minStripPixels pixels, a few strips per
+  // thread helps to balance the load.
+  constexpr size_t minStripPixels = 65536;
+  size_t threads = std::max(size_t(1), size_t(std::thread::hardware_concurrency()));
+  if(maxThreads>0)
+    threads = std::min(threads, maxThreads);
 
+  size_t nStrips = std::min(h, std::min(threads*4, (w*h) / minStripPixels));
+  if(nStrips<2)
   {
-    const uint8_t* s = src.constData();
-    const uint8_t* sMax = s + (w*h);
-    int* d = map.data();
-    for(; s<sMax; s++, d++)
-      (*d) = (-int(*s))-1;
+    nStrips = 1;
+    maxThreads = 1;
   }
 
-  for(size_t y=0; y<h; y++)
+  auto stripRow = [&](size_t strip)
   {
-    for(size_t x=0; x<w; x++)
+    return (strip*h) / nStrips;
+  };
+
+  // The labels of each strip start at the index of its first pixel, each set is rooted at its
+  // smallest label which is the first label of the region in raster order. This is what makes the
+  // result independent of the number of strips and threads.
+  std::unique_ptr<Parent_lt[]> parent(new Parent_lt[w*h]);
+  std::vector<size_t> labels(nStrips, 0);
+  std::vector<size_t> roots(nStrips+1, 0);
+
+  const uint8_t* s = src.constData();
+  int* m = map.data();
+  Parent_lt* p = parent.get();
+
+  forEachStrip(nStrips, maxThreads, [&](size_t strip)
+  {
+    labels[strip] = labelStrip(s, m, p, w, stripRow(strip), stripRow(strip+1), addCorners);
+  });
+
+  if(nStrips>1)
+  {
+    forEachStrip(nStrips-1, maxThreads, [&](size_t strip)
     {
-      size_t offset = (y*w)+x;
+      joinStrips(s, m, p, w, stripRow(strip+1), addCorners);
+    });
+  }
 
-      //Don't bother if we already have a count for this
-      if(map[offset]>=0)
-        continue;
+  // After joining the strips a label is a root if it is its own parent.
+  auto forEachRoot = [&](size_t strip, const auto& closure)
+  {
+    int i = int(stripRow(strip)*w);
+    int iMax = i + int(labels[strip]);
+    for(; i<iMax; i++)
+      if(p[i].load(std::memory_order_relaxed)==i)
+        closure(i);
+  };
+
+  forEachStrip(nStrips, maxThreads, [&](size_t strip)
+  {
+    size_t c=0;
+    forEachRoot(strip, [&](int){c++;});
+    roots[strip+1] = c;
+  });
+
+  for(size_t strip=0; strip<nStrips; strip++)
+    roots[strip+1] += roots[strip];
+
+  regions.resize(roots[nStrips]);
+  if(calculateStats)
+    stats.resize(regions.size());
+
+  // Number the roots in raster order, a final index is marked by storing -(index+1) in the parent.
+  forEachStrip(nStrips, maxThreads, [&](size_t strip)
+  {
+    int ci = int(roots[strip]);
+    forEachRoot(strip, [&](int i)
+    {
+      ByteRegion& region = regions[size_t(ci)];
+      region.minX = w;
+      region.minY = h;
 
-      size_t i = ci;
       ci++;
-      int color = map[offset];
+      p[i].store(-ci, std::memory_order_relaxed);
+    });
+  });
 
-      map[offset] = int(i);
+  // Point every label straight at its index, a chain ends at the first index found.
+  forEachStrip(nStrips, maxThreads, [&](size_t strip)
+  {
+    int i = int(stripRow(strip)*w);
+    int iMax = i + int(labels[strip]);
+    for(; i<iMax; i++)
+    {
+      int r = p[i].load(std::memory_order_relaxed);
+      while(r>=0)
+        r = p[r].load(std::memory_order_relaxed);
+      p[i].store(r, std::memory_order_relaxed);
+    }
+  });
+
+  // Replace the labels with region indexes and add each run of pixels to its region. Each strip
+  // owns the regions rooted in it. Any other region in a strip is rooted above it so it must cross
+  // the first row of the strip, these are collected from that row and added once all the strips
+  // are done.
+  std::vector<std::vector<Partial_lt>> partials(nStrips);
+  forEachStrip(nStrips, maxThreads, [&](size_t strip)
+  {
+    size_t ownedMin = roots[strip];
+    size_t ownedMax = roots[strip+1];
+    std::vector<Partial_lt>& partial = partials[strip];
 
-      ByteRegion& region = regions[i];
-      region.value=uint8_t(-1-color);
-      region.count=0;
+    std::vector<size_t> shared;
+    {
+      const int* mi = m + stripRow(strip)*w;
+      const int* mMax = mi + w;
+      for(; mi<mMax; mi++)
+      {
+        auto i = size_t(-p[*mi].load(std::memory_order_relaxed)-1);
+        if(i<ownedMin)
+          shared.push_back(i);
+      }
 
-      partialCount=0;
-      partial[partialCount]={int(x-1), int(y  )}; partialCount++;
-      partial[partialCount]={int(x+1), int(y  )}; partialCount++;
-      partial[partialCount]={int(x  ), int(y-1)}; partialCount++;
-      partial[partialCount]={int(x  ), int(y+1)}; partialCount++;
+      std::sort(shared.begin(), shared.end());
+      shared.erase(std::unique(shared.begin(), shared.end()), shared.end());
 
-      if(addCorners)
+      partial.resize(shared.size());
+      for(size_t k=0; k<shared.size(); k++)
       {
-        partial[partialCount]={int(x+1), int(y+1)}; partialCount++;
-        partial[partialCount]={int(x+1), int(y-1)}; partialCount++;
-        partial[partialCount]={int(x-1), int(y-1)}; partialCount++;
-        partial[partialCount]={int(x-1), int(y+1)}; partialCount++;
+        Partial_lt& pr = partial[k];
+        pr.index = shared[k];
+        pr.region.minX = w;
+        pr.region.minY = h;
       }
+    }
 
-      while(partialCount>0)
+    size_t lastIndex = regions.size();
+    Partial_lt* last = nullptr;
+    auto sharedRegion = [&](size_t i)
+    {
+      if(i!=lastIndex)
       {
-        partialCount--;
-        auto px = size_t(partial[partialCount].first );
-        auto py = size_t(partial[partialCount].second);
+        lastIndex = i;
+        last = &partial[size_t(std::lower_bound(shared.begin(), shared.end(), i) - shared.begin())];
+      }
+      return last;
+    };
 
-        if(px>=w || py>=h)
-          continue;
+    size_t yMin = stripRow(strip);
+    size_t yMax = stripRow(strip+1);
 
-        size_t po = (py*w)+px;
+    // Without stats only the counts are needed, this is simplest done a pixel at a time.
+    if(!calculateStats)
+    {
+      int* mi = m + yMin*w;
+      int* mMax = m + yMax*w;
+      const uint8_t* si = s + yMin*w;
+      for(; mi<mMax; mi++, si++)
+      {
+        auto i = size_t(-p[*mi].load(std::memory_order_relaxed)-1);
+        (*mi) = int(i);
 
-        if(done[po]==int(i))
-          continue;
+        if(i>=ownedMin && i<ownedMax)
+        {
+          ByteRegion& region = regions[i];
+          region.value = *si;
+          region.count++;
+        }
+        else
+          sharedRegion(i)->region.count++;
+      }
+      return;
+    }
 
-        done[po]=int(i);
+    auto run = [&](size_t i, size_t y, size_t x0, size_t x1)
+    {
+      if(i>=ownedMin && i<ownedMax)
+      {
+        ByteRegion& region = regions[i];
+        region.value = s[y*w+x0];
+        region.count += x1-x0;
+        addRunStats(region, stats[i], s, w, h, y, x0, x1);
+        return;
+      }
 
-        if(map[size_t(po)]!=color)
-          continue;
+      Partial_lt* pr = sharedRegion(i);
+      pr->region.count += x1-x0;
+      addRunStats(pr->region, pr->stats, s, w, h, y, x0, x1);
+    };
 
-        region.count++;
-        map[po]=int(i);
-        partial[partialCount]={int(px-1), int(py  )}; partialCount++;
-        partial[partialCount]={int(px+1), int(py  )}; partialCount++;
-        partial[partialCount]={int(px  ), int(py-1)}; partialCount++;
-        partial[partialCount]={int(px  ), int(py+1)}; partialCount++;
+    for(size_t y=yMin; y<yMax; y++)
+    {
+      int* mRow = m + y*w;
+      int label = mRow[0];
+      auto index = size_t(-p[label].load(std::memory_order_relaxed)-1);
+      mRow[0] = int(index);
 
-        if(addCorners)
+      size_t x0=0;
+      for(size_t x=1; x<w; x++)
+      {
+        // Neighbouring pixels mostly share a label, only look up the index when it changes.
+        if(mRow[x]!=label)
         {
-          partial[partialCount]={int(px+1), int(py+1)}; partialCount++;
-          partial[partialCount]={int(px+1), int(py-1)}; partialCount++;
-          partial[partialCount]={int(px-1), int(py-1)}; partialCount++;
-          partial[partialCount]={int(px-1), int(py+1)}; partialCount++;
+          label = mRow[x];
+          auto i = size_t(-p[label].load(std::memory_order_relaxed)-1);
+          if(i!=index)
+          {
+            run(index, y, x0, x);
+            x0 = x;
+            index = i;
+          }
         }
+
+        mRow[x] = int(index);
       }
+      run(index, y, x0, w);
     }
-  }
+  });
+
+  for(const auto& partial : partials)
+  {
+    for(const Partial_lt& pr : partial)
+    {
+      ByteRegion& region = regions[pr.index];
+      region.count += pr.region.count;
 
-  regions.resize(ci);
+      if(!calculateStats)
+        continue;
 
-  delete[] done;
-  delete[] partial;
+      region.minX = std::min(region.minX, pr.region.minX);
+      region.minY = std::min(region.minY, pr.region.minY);
+      region.maxX = std::max(region.maxX, pr.region.maxX);
+      region.maxY = std::max(region.maxY, pr.region.maxY);
+
+      ByteRegionStats& st = stats[pr.index];
+      st.m00 += pr.stats.m00;
+      st.m10 += pr.stats.m10;
+      st.m01 += pr.stats.m01;
+      st.m20 += pr.stats.m20;
+      st.m11 += pr.stats.m11;
+      st.m02 += pr.stats.m02;
+      st.perimeter += pr.stats.perimeter;
+    }
+  }
 }
 
 //##################################################################################################
@@ -147,12 +541,70 @@ void ByteRegions::calculateBoundingBoxes()
   }
 }
 
+//##################################################################################################
+double ByteRegionStats::centroidX()const
+{
+  return m10/m00;
+}
+
+//##################################################################################################
+double ByteRegionStats::centroidY()const
+{
+  return m01/m00;
+}
+
+//##################################################################################################
+double ByteRegionStats::mu20()const
+{
+  double cx = centroidX();
+  return m20/m00 - cx*cx;
+}
+
+//##################################################################################################
+double ByteRegionStats::mu11()const
+{
+  return m11/m00 - centroidX()*centroidY();
+}
+
+//##################################################################################################
+double ByteRegionStats::mu02()const
+{
+  double cy = centroidY();
+  return m02/m00 - cy*cy;
+}
+
+//##################################################################################################
+double ByteRegionStats::orientation()const
+{
+  return 0.5*std::atan2(2.0*mu11(), mu20()-mu02());
+}
+
+//##################################################################################################
+double ByteRegionStats::eccentricity()const
+{
+  double a = mu20();
+  double c = mu02();
+  double b = mu11();
+
+  // The eigenvalues of the covariance matrix are the squared lengths of the ellipse axes.
+  double mean = (a+c)*0.5;
+  double d = std::sqrt((a-c)*(a-c)*0.25 + b*b);
+  double major = mean+d;
+  double minor = std::max(mean-d, 0.0);
+
+  if(major<=0.0)
+    return 0.0;
+
+  return std::sqrt(1.0 - minor/major);
+}
+
 //##################################################################################################
 tp_image_utils::ByteMap deNoise(const tp_image_utils::ByteMap& src,
                                 size_t minSize,
                                 bool addCorners,
                                 uint8_t solid,
-                                uint8_t space)
+                                uint8_t space,
+                                size_t maxThreads)
 {
   if(minSize<2)
     return src;
@@ -164,7 +616,7 @@ tp_image_utils::ByteMap deNoise(const tp_image_utils::ByteMap& src,
     return src;
 
   tp_image_utils::ByteMap dst(w, h);
-  ByteRegions regions(src, addCorners);
+  ByteRegions regions(src, addCorners, false, maxThreads);
 
   uint8_t* d = dst.data();
   for(size_t y=0; y<h; y++)
@@ -192,7 +644,8 @@ tp_image_utils::ByteMap deNoiseBlobs(const tp_image_utils::ByteMap& src,
                      size_t maxSize,
                      bool addCorners,
                      uint8_t solid,
-                     uint8_t space)
+                     uint8_t space,
+                     size_t maxThreads)
 {
   size_t w = src.width();
   size_t h = src.height();
@@ -201,8 +654,7 @@ tp_image_utils::ByteMap deNoiseBlobs(const tp_image_utils::ByteMap& src,
     return src;
 
   tp_image_utils::ByteMap dst(w, h);
-  ByteRegions regions(src, addCorners);
-  regions.calculateBoundingBoxes();
+  ByteRegions regions(src, addCorners, true, maxThreads);
 
   std::vector<int> erase;
   erase.resize(regions.regions.size());
@@ -1,8 +1,11 @@
 #include "tp_image_utils_functions/GaussBlurEngine.h"
 #include "tp_image_utils_functions/BoxBlur.h"
 
+#include "tp_image_utils/ColorMap.h"
+#include "tp_image_utils/ColorMapF.h"
 
 #include <vector>
+#include <cstring>
 #include <cmath>
 #include <thread>
 #include <atomic>
@@ -218,6 +221,11 @@ private:
   cl::Kernel boxBlurT_4;
   cl::CommandQueue queue;
 
+  // Device buffers are kept between frames and only grow.
+  cl::Buffer buffer_A;
+  cl::Buffer buffer_B;
+  size_t bufferSize{0};
+
   std::stringstream errors;
   std::stringstream info;
 
@@ -282,16 +290,30 @@ public:
     queue = cl::CommandQueue(context,default_device);
   }
 
+  void reserve(size_t bufSize)
+  {
+    if(isFailed() || bufSize<=bufferSize)
+      return;
+
+    buffer_A = cl::Buffer(context,CL_MEM_READ_WRITE, bufSize);
+    buffer_B = cl::Buffer(context,CL_MEM_READ_WRITE, bufSize);
+    bufferSize = bufSize;
+  }
+
+  void releaseMemory()
+  {
+    buffer_A = cl::Buffer();
+    buffer_B = cl::Buffer();
+    bufferSize = 0;
+  }
+
   void doBlur(float* scl, size_t w, size_t h, size_t r)
   {
     if(!isFailed())
     {
       //For arrays source, target, we need to allocate the space on the device:
       size_t bufSize = sizeof(float)*h*w*3;
-
-      // create buffers on the device
-      cl::Buffer buffer_A(context,CL_MEM_READ_WRITE, bufSize);
-      cl::Buffer buffer_B(context,CL_MEM_READ_WRITE, bufSize);
+      reserve(bufSize);
 
       //write arrays A and B to the device
       queue.enqueueWriteBuffer(buffer_A,CL_TRUE,0, bufSize, scl);
@@ -374,11 +396,188 @@ void GaussBlurEngine::doBlur(float* scl, size_t w, size_t h, size_t r)
   else
 #endif
   {
-    std::unique_ptr<float[]> aux(new float[w*h*3]);
-    gaussBlur_4_cpu(scl, aux.get(), w, h, r);
+    if(m_aux.size()<w*h*3)
+      m_aux.resize(w*h*3);
+    m_cpuInfo = gaussBlurBoxes<float, 3>(scl, m_aux.data(), w, h, r, BlurBorder::Clamp, m_backend, m_maxThreads);
+    m_cpuUsed = true;
   }
 }
 
+//##################################################################################################
+void GaussBlurEngine::doBlur(const tp_image_utils::ColorMap& source, tp_image_utils::ColorMap& result, size_t r)
+{
+  size_t w = source.width();
+  size_t h = source.height();
+  reserve(w, h);
+
+  if(result.width()!=w || result.height()!=h)
+    result.setSize(w, h);
+
+#ifdef USE_OPENCL
+  if(!oclGaussBlur)
+    oclGaussBlur.reset(new GaussBlurAccelerator());
+
+  if(!oclGaussBlur->isFailed())
+  {
+    {
+      float* d = m_pixels.data();
+      auto s = source.constData();
+      auto sMax = s+source.size();
+      for(; s<sMax; s++, d+=3)
+      {
+        d[0] = s->r;
+        d[1] = s->g;
+        d[2] = s->b;
+      }
+    }
+
+    doBlur(m_pixels.data(), w, h, r);
+
+    {
+      const float* s = m_pixels.data();
+      auto d = result.data();
+      auto dMax = d+result.size();
+      for(; d<dMax; d++, s+=3)
+      {
+        d->r = uint8_t(s[0]+0.5f);
+        d->g = uint8_t(s[1]+0.5f);
+        d->b = uint8_t(s[2]+0.5f);
+        d->a = 255;
+      }
+    }
+    return;
+  }
+#endif
+
+  // The CPU blurs the RGBA bytes directly, the float scratch buffer has room for 4 bytes per pixel.
+  if(&result != &source)
+    std::memcpy(result.data(), source.constData(), sizeof(TPPixel)*w*h);
+
+  auto bytes = reinterpret_cast<uint8_t*>(result.data());
+  auto aux = reinterpret_cast<uint8_t*>(m_aux.data());
+  m_cpuInfo = gaussBlurBoxes<uint8_t, 4>(bytes, aux, w, h, r, BlurBorder::Clamp, m_backend, m_maxThreads);
+  m_cpuUsed = true;
+
+  auto d = result.data();
+  auto dMax = d+result.size();
+  for(; d<dMax; d++)
+    d->a = 255;
+}
+
+//##################################################################################################
+void GaussBlurEngine::doBlur(const tp_image_utils::ColorMapF& source, tp_image_utils::ColorMapF& result, size_t r)
+{
+  size_t w = source.width();
+  size_t h = source.height();
+  reserve(w, h);
+
+  if(result.width()!=w || result.height()!=h)
+    result.setSize(w, h);
+
+#ifdef USE_OPENCL
+  if(!oclGaussBlur)
+    oclGaussBlur.reset(new GaussBlurAccelerator());
+
+  if(!oclGaussBlur->isFailed())
+  {
+    {
+      float* d = m_pixels.data();
+      auto s = source.constData();
+      auto sMax = s+source.size();
+      for(; s<sMax; s++, d+=3)
+      {
+        d[0] = s->x;
+        d[1] = s->y;
+        d[2] = s->z;
+      }
+    }
+
+    doBlur(m_pixels.data(), w, h, r);
+
+    {
+      const float* s = m_pixels.data();
+      auto d = result.data();
+      auto dMax = d+result.size();
+      for(; d<dMax; d++, s+=3)
+      {
+        d->x = s[0];
+        d->y = s[1];
+        d->z = s[2];
+        d->w = 1.0f;
+      }
+    }
+    return;
+  }
+#endif
+
+  // The CPU blurs the vec4 storage of the result in place.
+  if(&result != &source)
+    std::memcpy(result.data(), source.constData(), sizeof(glm::vec4)*w*h);
+
+  m_cpuInfo = gaussBlurBoxes<float, 4>(&result.data()->x, m_aux.data(), w, h, r, BlurBorder::Clamp, m_backend, m_maxThreads);
+  m_cpuUsed = true;
+
+  auto d = result.data();
+  auto dMax = d+result.size();
+  for(; d<dMax; d++)
+    d->w = 1.0f;
+}
+
+//##################################################################################################
+void GaussBlurEngine::reserve(size_t w, size_t h)
+{
+#ifdef USE_OPENCL
+  if(m_pixels.size()<w*h*3)
+    m_pixels.resize(w*h*3);
+
+  if(oclGaussBlur)
+    oclGaussBlur->reserve(sizeof(float)*w*h*3);
+
+  if(oclGaussBlur && !oclGaussBlur->isFailed())
+    return;
+#endif
+
+  // The CPU paths blur in place and need scratch for up to 4 values per pixel.
+  if(m_aux.size()<w*h*4)
+    m_aux.resize(w*h*4);
+}
+
+//##################################################################################################
+void GaussBlurEngine::releaseMemory()
+{
+  std::vector<float>().swap(m_pixels);
+  std::vector<float>().swap(m_aux);
+
+#ifdef USE_OPENCL
+  if(oclGaussBlur)
+    oclGaussBlur->releaseMemory();
+#endif
+}
+
+//##################################################################################################
+void GaussBlurEngine::setBackend(BoxBlurBackend backend)
+{
+  m_backend = backend;
+}
+
+//##################################################################################################
+BoxBlurBackend GaussBlurEngine::backend()const
+{
+  return m_backend;
+}
+
+//##################################################################################################
+void GaussBlurEngine::setMaxThreads(size_t maxThreads)
+{
+  m_maxThreads = maxThreads;
+}
+
+//##################################################################################################
+size_t GaussBlurEngine::maxThreads()const
+{
+  return m_maxThreads;
+}
+
 std::string GaussBlurEngine::getErrorString()
 {
 #ifdef USE_OPENCL
@@ -393,12 +592,16 @@ std::string GaussBlurEngine::getErrorString()
 std::string GaussBlurEngine::getInfoString()
 {
 #ifdef USE_OPENCL
-  if(oclGaussBlur)
+  if(oclGaussBlur && !oclGaussBlur->isFailed())
     return oclGaussBlur->getInfoString();
-  return "OpenCL capability not found using CPU for blur";
-#else
-  return "BUILT WITHOUT USE_OPENCL FLAG";
 #endif
+
+  std::stringstream info;
+  if(m_cpuUsed)
+    info << "CPU backend: " << boxBlurBackendToString(m_cpuInfo.backend) << " threads: " << m_cpuInfo.threads;
+  else
+    info << "CPU backend: " << boxBlurBackendToString(resolveBoxBlurBackend(m_backend)) << " not used yet";
+  return info.str();
 }
 
 }
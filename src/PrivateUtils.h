@@ -0,0 +1,125 @@
+#ifndef tp_image_utils_functions_PrivateUtils_h
+#define tp_image_utils_functions_PrivateUtils_h
+
+#include "tp_utils/Parallel.h"
+
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace tp_image_utils_functions
+{
+
+//##################################################################################################
+//! Share n units of work between up to maxThreads threads
+/*!
+The closure is called on each thread with a function that claims the next unit of work, once all
+units have been claimed it returns n or more.
+
+No more threads are started than there are units of work. The calling thread is one of the workers
+and if fewer threads than tp_utils::parallel would start are required the rest are started here, so
+a small cap does not pay to start and join every thread of the pool.
+
+\param maxThreads - The maximum number of threads to use, 0 will use all available threads.
+\param n - The number of units of work.
+\param closure - Called with the claim function on each thread.
+\return The number of threads that claimed at least one unit of work.
+*/
+template<typename T>
+size_t parallelWorkers(size_t maxThreads, size_t n, const T& closure)
+{
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> used{0};
+  auto worker = [&]
+  {
+    bool claimed=false;
+    closure([&]
+    {
+      size_t i = next++;
+      if(!claimed && i<n)
+      {
+        claimed = true;
+        used++;
+      }
+      return i;
+    });
+  };
+
+  size_t available = std::max(size_t(std::thread::hardware_concurrency()), size_t(1));
+  size_t threads = std::min((maxThreads==0)?available:maxThreads, n);
+
+  if(threads<=1)
+    worker();
+  else if(threads>=available)
+  {
+    std::atomic<size_t> workers{0};
+    tp_utils::parallel([&](auto /*locker*/)
+    {
+      if(size_t index=workers++; index<threads)
+        worker();
+    });
+  }
+  else
+  {
+    std::vector<std::thread> started;
+    started.reserve(threads-1);
+    for(size_t i=1; i<threads; i++)
+      started.emplace_back(worker);
+    worker();
+    for(std::thread& thread : started)
+      thread.join();
+  }
+
+  return used;
+}
+
+//##################################################################################################
+inline int loadLabel(const int& label)
+{
+  return label;
+}
+
+//##################################################################################################
+inline int loadLabel(const std::atomic<int>& label)
+{
+  return label.load(std::memory_order_relaxed);
+}
+
+//##################################################################################################
+inline void storeLabel(int& label, int value)
+{
+  label = value;
+}
+
+//##################################################################################################
+inline void storeLabel(std::atomic<int>& label, int value)
+{
+  label.store(value, std::memory_order_relaxed);
+}
+
+//##################################################################################################
+//! Find the root of a union-find label, halving the path on the way.
+/*!
+parent can hold int or std::atomic<int> labels. With atomic labels this is safe to call while other
+threads are joining sets, as long as a label only ever points to one of its ancestors, path halving
+only stores ancestors.
+*/
+template<typename Label>
+int findRoot(Label* parent, int i)
+{
+  for(;;)
+  {
+    int p = loadLabel(parent[i]);
+    if(p==i)
+      return i;
+
+    int g = loadLabel(parent[p]);
+    storeLabel(parent[i], g);
+    i = g;
+  }
+}
+
+}
+
+#endif
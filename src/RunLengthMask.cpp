@@ -0,0 +1,381 @@
+#include "tp_image_utils_functions/RunLengthMask.h"
+
+#include "PrivateUtils.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace tp_image_utils_functions
+{
+
+namespace
+{
+using Run = RunLengthMask::Run;
+
+//##################################################################################################
+//! Call start(x0, x1) for each range of columns solid in cur but not prev, and end(x0, x1) for each
+//! range solid in prev but not cur.
+template<typename Start, typename End>
+void forEachChange(const Run* prev, const Run* prevEnd, const Run* cur, const Run* curEnd, const Start& start, const End& end)
+{
+  // Walk the run boundaries of both rows in order, even boundaries are starts and odd are ends so
+  // the parity of the count passed says if a column is inside a run.
+  auto boundary = [](const Run* runs, size_t i)
+  {
+    const Run& r = runs[i/2];
+    return (i&1)?r.x1:r.x0;
+  };
+
+  size_t np = size_t(prevEnd-prev)*2;
+  size_t nc = size_t(curEnd-cur)*2;
+  size_t ip=0;
+  size_t ic=0;
+  uint32_t x=0;
+
+  while(ip<np || ic<nc)
+  {
+    uint32_t bp = (ip<np)?boundary(prev, ip):std::numeric_limits<uint32_t>::max();
+    uint32_t bc = (ic<nc)?boundary(cur,  ic):std::numeric_limits<uint32_t>::max();
+    uint32_t b = std::min(bp, bc);
+
+    bool inPrev = ip&1;
+    bool inCur  = ic&1;
+    if(b>x)
+    {
+      if(inCur && !inPrev)
+        start(x, b);
+      else if(inPrev && !inCur)
+        end(x, b);
+    }
+
+    x = b;
+    if(bp==b)
+      ip++;
+    if(bc==b)
+      ic++;
+  }
+}
+
+//##################################################################################################
+//! Keep the runs of each row that are not shorter than minSize or that touch the edge of the row.
+RunLengthMask removeShortRuns(const RunLengthMask& src, size_t minSize)
+{
+  size_t w = src.width();
+  RunLengthMask dst(w, src.height());
+  for(size_t y=0; y<src.height(); y++)
+    for(const Run* r=src.rowBegin(y); r<src.rowEnd(y); r++)
+      if(r->x0==0 || r->x1==w || size_t(r->x1-r->x0)>=minSize)
+        dst.appendRun(y, r->x0, r->x1);
+  return dst;
+}
+}
+
+//##################################################################################################
+RunLengthMask::RunLengthMask():
+  m_rowStarts(1, 0)
+{
+
+}
+
+//##################################################################################################
+RunLengthMask::RunLengthMask(size_t width, size_t height):
+  m_width(width),
+  m_height(height),
+  m_rowStarts(std::max(height, size_t(1)), 0)
+{
+
+}
+
+//##################################################################################################
+RunLengthMask::RunLengthMask(const tp_image_utils::ByteMap& src, uint8_t solid):
+  RunLengthMask(src.width(), src.height())
+{
+  for(size_t y=0; y<m_height; y++)
+  {
+    const uint8_t* s = src.constData() + y*m_width;
+    size_t x=0;
+    while(x<m_width)
+    {
+      for(; x<m_width && s[x]!=solid; x++){}
+      size_t x0=x;
+      for(; x<m_width && s[x]==solid; x++){}
+      if(x>x0)
+        appendRun(y, x0, x);
+    }
+  }
+}
+
+//##################################################################################################
+tp_image_utils::ByteMap RunLengthMask::toByteMap(uint8_t solid, uint8_t space)const
+{
+  tp_image_utils::ByteMap dst(m_width, m_height);
+  for(size_t y=0; y<m_height; y++)
+  {
+    uint8_t* d = dst.data() + y*m_width;
+    std::fill(d, d+m_width, space);
+    for(const Run* r=rowBegin(y); r<rowEnd(y); r++)
+      std::fill(d+r->x0, d+r->x1, solid);
+  }
+  return dst;
+}
+
+//##################################################################################################
+size_t RunLengthMask::width()const
+{
+  return m_width;
+}
+
+//##################################################################################################
+size_t RunLengthMask::height()const
+{
+  return m_height;
+}
+
+//##################################################################################################
+size_t RunLengthMask::runCount()const
+{
+  return m_runs.size();
+}
+
+//##################################################################################################
+size_t RunLengthMask::pixelCount()const
+{
+  size_t c=0;
+  for(const Run& r : m_runs)
+    c += r.x1-r.x0;
+  return c;
+}
+
+//##################################################################################################
+const RunLengthMask::Run* RunLengthMask::rowBegin(size_t y)const
+{
+  return m_runs.data() + ((y<=m_openRow)?m_rowStarts[y]:m_runs.size());
+}
+
+//##################################################################################################
+const RunLengthMask::Run* RunLengthMask::rowEnd(size_t y)const
+{
+  return m_runs.data() + ((y<m_openRow)?m_rowStarts[y+1]:m_runs.size());
+}
+
+//##################################################################################################
+void RunLengthMask::appendRun(size_t y, size_t x0, size_t x1)
+{
+  x1 = std::min(x1, m_width);
+  if(x1<=x0 || y>=m_height || y<m_openRow)
+    return;
+
+  for(; m_openRow<y; m_openRow++)
+    m_rowStarts[m_openRow+1] = m_runs.size();
+
+  if(m_runs.size()>m_rowStarts[y] && m_runs.back().x1>=x0)
+  {
+    Run& last = m_runs.back();
+    last.x1 = uint32_t(std::max(size_t(last.x1), x1));
+    return;
+  }
+
+  m_runs.push_back({uint32_t(x0), uint32_t(x1)});
+}
+
+//##################################################################################################
+bool RunLengthMask::boundingBox(size_t& minX, size_t& minY, size_t& maxX, size_t& maxY)const
+{
+  if(m_runs.empty())
+    return false;
+
+  minX = m_width;
+  maxX = 0;
+  minY = m_height;
+  maxY = 0;
+
+  for(size_t y=0; y<m_height; y++)
+  {
+    const Run* b = rowBegin(y);
+    const Run* e = rowEnd(y);
+    if(b==e)
+      continue;
+
+    minY = std::min(minY, y);
+    maxY = y;
+    minX = std::min(minX, size_t(b->x0));
+    maxX = std::max(maxX, size_t((e-1)->x1)-1);
+  }
+
+  return true;
+}
+
+//##################################################################################################
+bool RunLengthMask::anySolid(size_t x, size_t y, size_t width, size_t height)const
+{
+  if(width<1 || x>=m_width || y>=m_height)
+    return false;
+
+  // Clamp before adding so that very large sizes do not wrap.
+  size_t xMax = x + std::min(width, m_width-x);
+  size_t yMax = y + std::min(height, m_height-y);
+
+  for(; y<yMax; y++)
+  {
+    // Find the first run that ends after x, the row is solid in the rectangle if it starts before xMax.
+    const Run* e = rowEnd(y);
+    const Run* r = std::upper_bound(rowBegin(y), e, x, [](size_t v, const Run& run){return v<run.x1;});
+    if(r<e && r->x0<xMax)
+      return true;
+  }
+
+  return false;
+}
+
+//##################################################################################################
+RunLengthMask RunLengthMask::transposed()const
+{
+  // A column run starts where a column becomes solid from one row to the next and ends where it
+  // stops being solid. Only the ranges of columns that change between rows are visited. The first
+  // sweep counts the runs in each column so that the second can write them in place.
+  auto sweep = [&](const auto& start, const auto& end)
+  {
+    const Run* none = m_runs.data();
+    for(size_t y=0; y<=m_height; y++)
+    {
+      const Run* pb = (y>0)?rowBegin(y-1):none;
+      const Run* pe = (y>0)?rowEnd(y-1):none;
+      const Run* cb = (y<m_height)?rowBegin(y):none;
+      const Run* ce = (y<m_height)?rowEnd(y):none;
+      forEachChange(pb, pe, cb, ce, [&](uint32_t x0, uint32_t x1){start(y, x0, x1);}, [&](uint32_t x0, uint32_t x1){end(y, x0, x1);});
+    }
+  };
+
+  RunLengthMask dst(m_height, m_width);
+  if(m_width<1 || m_height<1)
+    return dst;
+
+  std::vector<size_t> next(m_width+1, 0);
+  sweep([](size_t, uint32_t, uint32_t){}, [&](size_t, uint32_t x0, uint32_t x1)
+  {
+    for(uint32_t x=x0; x<x1; x++)
+      next[x+1]++;
+  });
+
+  for(size_t x=0; x<m_width; x++)
+    next[x+1] += next[x];
+
+  dst.m_runs.resize(next[m_width]);
+  for(size_t x=0; x<m_width; x++)
+    dst.m_rowStarts[x] = next[x];
+  dst.m_openRow = m_width-1;
+
+  std::vector<uint32_t> open(m_width, 0);
+  sweep([&](size_t y, uint32_t x0, uint32_t x1)
+  {
+    std::fill(open.data()+x0, open.data()+x1, uint32_t(y));
+  },
+  [&](size_t y, uint32_t x0, uint32_t x1)
+  {
+    for(uint32_t x=x0; x<x1; x++)
+      dst.m_runs[next[x]++] = {open[x], uint32_t(y)};
+  });
+
+  return dst;
+}
+
+//##################################################################################################
+RunLengthRegions::RunLengthRegions(const RunLengthMask& mask, bool addCorners)
+{
+  size_t h = mask.height();
+  runRegions.resize(mask.runCount());
+  if(runRegions.empty())
+    return;
+
+  // Each run starts as its own set, runs are in raster order and sets are rooted at their smallest
+  // run so the roots are in the raster order of the first pixel of each region.
+  std::vector<int> parent(runRegions.size());
+  for(size_t i=0; i<parent.size(); i++)
+    parent[i] = int(i);
+
+  const RunLengthMask::Run* first = mask.rowBegin(0);
+
+  // Runs touch if they overlap, with corners they also touch if they are diagonally adjacent.
+  uint32_t reach = addCorners?1:0;
+  for(size_t y=1; y<h; y++)
+  {
+    const RunLengthMask::Run* p = mask.rowBegin(y-1);
+    const RunLengthMask::Run* pe = mask.rowEnd(y-1);
+    const RunLengthMask::Run* c = mask.rowBegin(y);
+    const RunLengthMask::Run* ce = mask.rowEnd(y);
+
+    while(p<pe && c<ce)
+    {
+      if(p->x0 < c->x1+reach && c->x0 < p->x1+reach)
+      {
+        int a = findRoot(parent.data(), int(p-first));
+        int b = findRoot(parent.data(), int(c-first));
+        if(a<b)
+          parent[size_t(b)] = a;
+        else if(b<a)
+          parent[size_t(a)] = b;
+      }
+
+      // Step past whichever run ends first, it can not touch any later run of the other row.
+      if(p->x1<c->x1)
+        p++;
+      else
+        c++;
+    }
+  }
+
+  // Flatten the sets into consecutive region indexes, parents are always visited before children.
+  size_t ci=0;
+  for(size_t i=0; i<parent.size(); i++)
+    runRegions[i] = (size_t(parent[i])<i)?runRegions[size_t(parent[i])]:int(ci++);
+
+  regions.resize(ci);
+  for(ByteRegion& region : regions)
+  {
+    region.minX = mask.width();
+    region.minY = h;
+  }
+
+  for(size_t y=0; y<h; y++)
+  {
+    for(const RunLengthMask::Run* r=mask.rowBegin(y); r<mask.rowEnd(y); r++)
+    {
+      ByteRegion& region = regions[size_t(runRegions[size_t(r-first)])];
+      region.count += r->x1-r->x0;
+      region.minX = std::min(region.minX, size_t(r->x0));
+      region.maxX = std::max(region.maxX, size_t(r->x1)-1);
+      region.minY = std::min(region.minY, y);
+      region.maxY = std::max(region.maxY, y);
+    }
+  }
+}
+
+//##################################################################################################
+RunLengthMask deNoise(const RunLengthMask& src, size_t minSize, bool addCorners)
+{
+  if(minSize<2)
+    return src;
+
+  RunLengthRegions regions(src, addCorners);
+
+  RunLengthMask dst(src.width(), src.height());
+  const RunLengthMask::Run* first = src.rowBegin(0);
+  for(size_t y=0; y<src.height(); y++)
+    for(const RunLengthMask::Run* r=src.rowBegin(y); r<src.rowEnd(y); r++)
+      if(regions.regions[size_t(regions.runRegions[size_t(r-first)])].count>=minSize)
+        dst.appendRun(y, r->x0, r->x1);
+
+  return dst;
+}
+
+//##################################################################################################
+RunLengthMask deNoiseStripes(const RunLengthMask& src, size_t minSize)
+{
+  if(minSize<2 || src.width()<1 || src.height()<1)
+    return src;
+
+  RunLengthMask columns = removeShortRuns(src.transposed(), minSize);
+  return removeShortRuns(columns.transposed(), minSize);
+}
+
+}
@@ -1,10 +1,16 @@
 #include "tp_image_utils_functions/SignedDistanceField.h"
 
 #include "tp_image_utils/ColorMap.h"
+#include "tp_image_utils/ColorMapF.h"
 
 #include "tp_quad_tree/QuadTreeInt.h"
 
+#include "PrivateUtils.h"
+
 #include <cmath>
+#include <limits>
+#include <atomic>
+#include <cstring>
 
 namespace tp_image_utils_functions
 {
@@ -12,10 +18,12 @@ namespace tp_image_utils_functions
 namespace
 {
 const int cellSize = 70;
-}
+
+//! The number of adjacent columns processed together by the column pass.
+const size_t columnBlockSize = 16;
 
 //##################################################################################################
-tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src, int radius)
+tp_image_utils::ColorMap signedDistanceFieldQuadTree(const tp_image_utils::ColorMap& src, int radius)
 {
   tp_image_utils::ColorMap dst(src.width(), src.height());
 
@@ -30,7 +38,7 @@ tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src
   for(size_t y=0; y<h; y++)
   {
     const TPPixel* s = src.constData() + (y*w);
-    const TPPixel* sMax = s + (4*w);
+    const TPPixel* sMax = s + w;
 
     int x=0;
     while(s<sMax)
@@ -84,7 +92,7 @@ tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src
 }
 
 //##################################################################################################
-tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src, int radius, int width, int height)
+tp_image_utils::ColorMap signedDistanceFieldQuadTree(const tp_image_utils::ColorMap& src, int radius, int width, int height)
 {
   tp_image_utils::ColorMap dst{size_t(width), size_t(height)};
 
@@ -118,14 +126,14 @@ tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src
     for(size_t y=0; y<size_t(height); y++)
     {
       auto sy = size_t(yf*float(y));
-      TPPixel* d = dst.data() + (y*w);
+      TPPixel* d = dst.data() + (y*size_t(width));
       float dist=float(radius);
 
       for(size_t x=0; x<size_t(width); x++)
       {
         auto sx = size_t(xf*float(x));
 
-        const TPPixel* s = src.constData() + (sy + w);
+        const TPPixel* s = src.constData() + (sy*w);
         s+=sx;
 
         dist+=xf;
@@ -158,7 +166,7 @@ tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src
 }
 
 //##################################################################################################
-tp_image_utils::ByteMap signedDistanceField(const tp_image_utils::ByteMap& src, int radius)
+tp_image_utils::ByteMap signedDistanceFieldQuadTree(const tp_image_utils::ByteMap& src, int radius)
 {
   tp_image_utils::ByteMap dst(src.width(), src.height());
 
@@ -217,7 +225,7 @@ tp_image_utils::ByteMap signedDistanceField(const tp_image_utils::ByteMap& src,
 }
 
 //##################################################################################################
-tp_image_utils::ByteMap distanceField(const tp_image_utils::ByteMap& src, int radius)
+tp_image_utils::ByteMap distanceFieldQuadTree(const tp_image_utils::ByteMap& src, int radius)
 {
   tp_image_utils::ByteMap dst(src.width(), src.height());
 
@@ -274,7 +282,7 @@ tp_image_utils::ByteMap distanceField(const tp_image_utils::ByteMap& src, int ra
 }
 
 //##################################################################################################
-tp_image_utils::ByteMap signedDistanceField(const tp_image_utils::ByteMap& src, int radius, int width, int height)
+tp_image_utils::ByteMap signedDistanceFieldQuadTree(const tp_image_utils::ByteMap& src, int radius, int width, int height)
 {
   tp_image_utils::ByteMap dst{size_t(width), size_t(height)};
 
@@ -334,4 +342,744 @@ tp_image_utils::ByteMap signedDistanceField(const tp_image_utils::ByteMap& src,
   return dst;
 }
 
+//##################################################################################################
+int64_t floorDiv(int64_t n, int64_t d)
+{
+  return (n>=0)?(n/d):(-((d-n-1)/d));
+}
+
+//##################################################################################################
+//! Calculate the distance along a row to the closest feature pixel.
+/*!
+\param w - The number of pixels in the row.
+\param inf - The value to use if the row contains no feature pixels.
+\param g - Filled with the distance to the closest feature pixel for each pixel in the row.
+\param isFeature - Returns true if the pixel at x is a feature pixel.
+*/
+template<typename IsFeature>
+void edtRowPass(size_t w, int32_t inf, int32_t* g, const IsFeature& isFeature)
+{
+  int32_t d=inf;
+  for(size_t x=0; x<w; x++)
+  {
+    if(isFeature(x))
+      d=0;
+    else if(d<inf)
+      d++;
+    g[x]=d;
+  }
+
+  d=inf;
+  for(size_t x=w; x>0; x--)
+  {
+    int32_t& gx = g[x-1];
+    if(gx==0)
+      d=0;
+    else
+    {
+      if(d<inf)
+        d++;
+      if(d<gx)
+        gx=d;
+    }
+  }
+}
+
+//##################################################################################################
+//! Calculate the lower envelope of the parabolas along a column.
+/*!
+This is the second phase of the exact Euclidean distance transform described by Meijster,
+Roerdink, and Hesselink, it runs in linear time.
+
+\param g - The row distance to the closest feature pixel for each of the n pixels in the column.
+\param n - The number of pixels in the column.
+\param dt - Filled with the squared distance to the closest feature for each pixel in the column.
+\param s - Scratch buffer of n elements.
+\param t - Scratch buffer of n elements.
+*/
+void edtColumnPass(const int32_t* g, size_t n, int64_t* dt, int64_t* s, int64_t* t)
+{
+  auto f = [g](int64_t x, int64_t i)
+  {
+    auto gi = int64_t(g[i]);
+    return (x-i)*(x-i) + gi*gi;
+  };
+
+  auto sep = [g](int64_t i, int64_t u)
+  {
+    auto gi = int64_t(g[i]);
+    auto gu = int64_t(g[u]);
+    return floorDiv((u*u) - (i*i) + (gu*gu) - (gi*gi), 2*(u-i));
+  };
+
+  auto m = int64_t(n);
+  int64_t q=0;
+  s[0]=0;
+  t[0]=0;
+
+  for(int64_t u=1; u<m; u++)
+  {
+    while(q>=0 && f(t[q], s[q])>f(t[q], u))
+      q--;
+
+    if(q<0)
+    {
+      q=0;
+      s[0]=u;
+    }
+    else
+    {
+      int64_t v = 1 + sep(s[q], u);
+      if(v<m)
+      {
+        q++;
+        s[q]=u;
+        t[q]=v;
+      }
+    }
+  }
+
+  for(int64_t u=m-1; u>=0; u--)
+  {
+    dt[u] = f(u, s[q]);
+    if(u==t[q])
+      q--;
+  }
+}
+
+//##################################################################################################
+//! Exact Euclidean distance transform.
+/*!
+Calculates the distance from each pixel to the closest feature pixel, this is separable and runs in
+linear time in the number of pixels regardless of radius or image content. The rows are processed
+in parallel followed by blocks of adjacent columns.
+
+\param w - The width of the image.
+\param h - The height of the image.
+\param maxThreads - The maximum number of threads to use, 0 will use all available threads.
+\param g - Scratch buffer, will be resized to w*h.
+\param isFeature - Returns true if the pixel at (x, y) is a feature pixel.
+\param store - Called with (x, y, dist) for each pixel, dist is inf if there are no feature pixels.
+*/
+template<typename IsFeature, typename Store>
+void distanceTransform(size_t w,
+                       size_t h,
+                       size_t maxThreads,
+                       std::vector<int32_t>& g,
+                       const IsFeature& isFeature,
+                       const Store& store)
+{
+  if(w<1 || h<1)
+    return;
+
+  auto inf = int32_t(w+h);
+  int64_t infSq = int64_t(inf)*int64_t(inf);
+
+  g.resize(w*h);
+
+  parallelWorkers(maxThreads, h, [&](const auto& next)
+  {
+    for(size_t y=next(); y<h; y=next())
+      edtRowPass(w, inf, g.data()+(y*w), [&](size_t x){return isFeature(x, y);});
+  });
+
+  {
+    size_t nBlocks = (w+columnBlockSize-1) / columnBlockSize;
+    parallelWorkers(maxThreads, nBlocks, [&](const auto& next)
+    {
+      std::vector<int32_t> columns(h*columnBlockSize);
+      std::vector<int64_t> dt(h*columnBlockSize);
+      std::vector<int64_t> s(h);
+      std::vector<int64_t> t(h);
+
+      for(size_t b=next(); b<nBlocks; b=next())
+      {
+        size_t x0 = b*columnBlockSize;
+        size_t bw = tpMin(columnBlockSize, w-x0);
+
+        //Transpose the block so that each column is contiguous.
+        for(size_t y=0; y<h; y++)
+        {
+          const int32_t* r = g.data() + (y*w) + x0;
+          for(size_t i=0; i<bw; i++)
+            columns[(i*h)+y] = r[i];
+        }
+
+        for(size_t i=0; i<bw; i++)
+          edtColumnPass(columns.data()+(i*h), h, dt.data()+(i*h), s.data(), t.data());
+
+        for(size_t y=0; y<h; y++)
+        {
+          for(size_t i=0; i<bw; i++)
+          {
+            int64_t d = dt[(i*h)+y];
+            store(x0+i, y, (d<infSq)?std::sqrt(float(d)):std::numeric_limits<float>::infinity());
+          }
+        }
+      }
+    });
+  }
+}
+
+//##################################################################################################
+//! Calculate the signed distance for each pixel
+/*!
+White pixels will get a positive distance to the closest black pixel, black pixels will get a
+negative distance to the closest white pixel.
+
+\param dst - The first of w*h output values.
+\param stride - The number of floats between consecutive output values.
+*/
+template<typename IsWhite>
+void signedDistances(size_t w, size_t h, size_t maxThreads, const IsWhite& isWhite, float* dst, size_t stride=1)
+{
+  std::vector<int32_t> g;
+
+  distanceTransform(w, h, maxThreads, g, [&](size_t x, size_t y){return !isWhite(x, y);}, [&](size_t x, size_t y, float dist)
+  {
+    if(isWhite(x, y))
+      dst[((y*w)+x)*stride] = dist;
+  });
+
+  distanceTransform(w, h, maxThreads, g, isWhite, [&](size_t x, size_t y, float dist)
+  {
+    if(!isWhite(x, y))
+      dst[((y*w)+x)*stride] = -dist;
+  });
+}
+
+//##################################################################################################
+//! Convert a signed distance into the 8 bit representation, saturating at the radius.
+uint8_t signedDistanceToByte(float dist, float maxDist, float f)
+{
+  if(dist>0.0f)
+    return uint8_t(127.0f + tpMin(tpMin(dist, maxDist)*f, 128.0f));
+  return uint8_t(128.0f - tpMin(tpMin(-dist, maxDist)*f, 128.0f));
+}
+
+//##################################################################################################
+//! Build the levels of a signed distance field pyramid
+/*!
+\param sdf - The full resolution raw signed distances, these will be clamped to the radius.
+\param convert - Called with (data, width, height) for each level starting at full resolution.
+*/
+template<typename Convert>
+void signedDistancePyramid(std::vector<float>& sdf,
+                           size_t w,
+                           size_t h,
+                           int radius,
+                           size_t levels,
+                           const Convert& convert)
+{
+  //Clamp first so that saturated values average the same way as the 8 bit output would.
+  float maxDist = std::sqrt(float(radius*radius));
+  for(float& d : sdf)
+    d = tpBound(-maxDist, d, maxDist);
+
+  std::vector<float> next;
+  for(size_t l=0; l<levels; l++)
+  {
+    convert(sdf.data(), w, h);
+
+    if((l+1)>=levels)
+      break;
+
+    size_t nw = tpMax(size_t(1), (w+1)/2);
+    size_t nh = tpMax(size_t(1), (h+1)/2);
+    next.resize(nw*nh);
+
+    float* d = next.data();
+    for(size_t y=0; y<nh; y++)
+    {
+      size_t y0 = y*2;
+      size_t y1 = tpMin(y0+1, h-1);
+      const float* r0 = sdf.data() + (y0*w);
+      const float* r1 = sdf.data() + (y1*w);
+
+      for(size_t x=0; x<nw; x++, d++)
+      {
+        size_t x0 = x*2;
+        size_t x1 = tpMin(x0+1, w-1);
+        (*d) = (r0[x0] + r0[x1] + r1[x0] + r1[x1]) * 0.25f;
+      }
+    }
+
+    sdf.swap(next);
+    w = nw;
+    h = nh;
+  }
+}
+
+//##################################################################################################
+//! Calculate part of an 8 bit distance field
+/*!
+To get the same result as processing the whole image the window must extend at least radius pixels
+beyond the region in each direction, or to the edge of the image.
+
+\param window - The mask pixels surrounding the region.
+\param rx - The x coordinate of the region in the window.
+\param ry - The y coordinate of the region in the window.
+\param rw - The width of the region.
+\param rh - The height of the region.
+\return The rw*rh pixels of the distance field for the region.
+*/
+tp_image_utils::ByteMap distanceFieldRegion(const tp_image_utils::ByteMap& window,
+                                            int radius,
+                                            bool signedField,
+                                            size_t maxThreads,
+                                            size_t rx,
+                                            size_t ry,
+                                            size_t rw,
+                                            size_t rh)
+{
+  size_t w = window.width();
+  size_t h = window.height();
+  const uint8_t* s = window.constData();
+
+  tp_image_utils::ByteMap dst(rw, rh);
+  uint8_t* d = dst.data();
+  float maxDist = std::sqrt(float(radius*radius));
+
+  if(signedField)
+  {
+    float f = 127.0f / float(radius);
+    std::vector<float> sdf(w*h);
+    signedDistances(w, h, maxThreads, [&](size_t x, size_t y){return s[(y*w)+x]>0;}, sdf.data());
+
+    for(size_t y=0; y<rh; y++)
+    {
+      const float* dist = sdf.data() + ((y+ry)*w) + rx;
+      for(size_t x=0; x<rw; x++, d++, dist++)
+        (*d) = signedDistanceToByte(*dist, maxDist, f);
+    }
+  }
+  else
+  {
+    float f = 255.0f / float(radius);
+    std::vector<int32_t> g;
+    distanceTransform(w, h, maxThreads, g, [&](size_t x, size_t y){return s[(y*w)+x]==0;}, [&](size_t x, size_t y, float dist)
+    {
+      if(x<rx || y<ry || x>=(rx+rw) || y>=(ry+rh))
+        return;
+
+      d[((y-ry)*rw)+(x-rx)] = (s[(y*w)+x]>0)?uint8_t(tpMin(tpMin(dist, maxDist)*f, 255.0f)):0;
+    });
+  }
+
+  return dst;
+}
+
+}
+
+//##################################################################################################
+const char* distanceFieldMethodToString(DistanceFieldMethod method)
+{
+  switch(method)
+  {
+  case DistanceFieldMethod::EDT:      return "EDT";
+  case DistanceFieldMethod::QuadTree: return "QuadTree";
+  }
+
+  return "EDT";
+}
+
+//##################################################################################################
+DistanceFieldMethod distanceFieldMethodFromString(const std::string& method)
+{
+  if(method == "EDT")      return DistanceFieldMethod::EDT;
+  if(method == "QuadTree") return DistanceFieldMethod::QuadTree;
+  return DistanceFieldMethod::EDT;
+}
+
+//##################################################################################################
+tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src,
+                                             int radius,
+                                             DistanceFieldMethod method,
+                                             size_t maxThreads)
+{
+  if(method == DistanceFieldMethod::QuadTree)
+    return signedDistanceFieldQuadTree(src, radius);
+
+  size_t w = src.width();
+  size_t h = src.height();
+
+  std::vector<float> sdf(w*h);
+  signedDistanceField(src, sdf.data(), maxThreads);
+  return signedDistanceFieldToColorMap(sdf.data(), w, h, radius);
+}
+
+//##################################################################################################
+tp_image_utils::ColorMap signedDistanceField(const tp_image_utils::ColorMap& src,
+                                             int radius,
+                                             int width,
+                                             int height,
+                                             DistanceFieldMethod method,
+                                             size_t maxThreads)
+{
+  if(method == DistanceFieldMethod::QuadTree)
+    return signedDistanceFieldQuadTree(src, radius, width, height);
+
+  tp_image_utils::ColorMap dst{size_t(width), size_t(height)};
+
+  size_t w = src.width();
+  size_t h = src.height();
+  float maxDist = std::sqrt(float(radius*radius));
+  float f = 127.0f / float(radius);
+
+  std::vector<float> sdf(w*h);
+  signedDistanceField(src, sdf.data(), maxThreads);
+
+  float xf = float(w)/float(width);
+  float yf = float(h)/float(height);
+
+  TPPixel* d = dst.data();
+  for(size_t y=0; y<size_t(height); y++)
+  {
+    auto sy = size_t(yf*float(y));
+    const float* dist = sdf.data() + (sy*w);
+
+    for(size_t x=0; x<size_t(width); x++, d++)
+    {
+      auto sx = size_t(xf*float(x));
+      uint8_t a = signedDistanceToByte(dist[sx], maxDist, f);
+      d->r = a;
+      d->g = a;
+      d->b = a;
+      d->a = 255;
+    }
+  }
+
+  return dst;
+}
+
+//##################################################################################################
+tp_image_utils::ByteMap signedDistanceField(const tp_image_utils::ByteMap& src,
+                                            int radius,
+                                            DistanceFieldMethod method,
+                                            size_t maxThreads)
+{
+  if(method == DistanceFieldMethod::QuadTree)
+    return signedDistanceFieldQuadTree(src, radius);
+
+  size_t w = src.width();
+  size_t h = src.height();
+
+  std::vector<float> sdf(w*h);
+  signedDistanceField(src, sdf.data(), maxThreads);
+  return signedDistanceFieldToByteMap(sdf.data(), w, h, radius);
+}
+
+//##################################################################################################
+tp_image_utils::ByteMap distanceField(const tp_image_utils::ByteMap& src,
+                                      int radius,
+                                      DistanceFieldMethod method,
+                                      size_t maxThreads)
+{
+  if(method == DistanceFieldMethod::QuadTree)
+    return distanceFieldQuadTree(src, radius);
+
+  size_t w = src.width();
+  size_t h = src.height();
+  float maxDist = std::sqrt(float(radius*radius));
+  float f = 255.0f / float(radius);
+
+  tp_image_utils::ByteMap dst(w, h);
+
+  const uint8_t* s = src.constData();
+  uint8_t* d = dst.data();
+  std::vector<int32_t> g;
+  distanceTransform(w, h, maxThreads, g, [&](size_t x, size_t y){return s[(y*w)+x]==0;}, [&](size_t x, size_t y, float dist)
+  {
+    size_t i = (y*w)+x;
+    d[i] = (s[i]>0)?uint8_t(tpMin(tpMin(dist, maxDist)*f, 255.0f)):0;
+  });
+
+  return dst;
+}
+
+//##################################################################################################
+tp_image_utils::ByteMap signedDistanceField(const tp_image_utils::ByteMap& src,
+                                            int radius,
+                                            int width,
+                                            int height,
+                                            DistanceFieldMethod method,
+                                            size_t maxThreads)
+{
+  if(method == DistanceFieldMethod::QuadTree)
+    return signedDistanceFieldQuadTree(src, radius, width, height);
+
+  tp_image_utils::ByteMap dst{size_t(width), size_t(height)};
+
+  size_t w = src.width();
+  size_t h = src.height();
+  float maxDist = std::sqrt(float(radius*radius));
+  float f = 127.0f / float(radius);
+
+  std::vector<float> sdf(w*h);
+  signedDistanceField(src, sdf.data(), maxThreads);
+
+  float xf = float(w)/float(width);
+  float yf = float(h)/float(height);
+
+  uint8_t* d = dst.data();
+  for(size_t y=0; y<size_t(height); y++)
+  {
+    auto sy = size_t(yf*float(y));
+    const float* dist = sdf.data() + (sy*w);
+
+    for(size_t x=0; x<size_t(width); x++, d++)
+      (*d) = signedDistanceToByte(dist[size_t(xf*float(x))], maxDist, f);
+  }
+
+  return dst;
+}
+
+//##################################################################################################
+void signedDistanceField(const tp_image_utils::ByteMap& src, float* dst, size_t maxThreads)
+{
+  size_t w = src.width();
+  const uint8_t* s = src.constData();
+  signedDistances(w, src.height(), maxThreads, [&](size_t x, size_t y){return s[(y*w)+x]>0;}, dst);
+}
+
+//##################################################################################################
+void signedDistanceField(const tp_image_utils::ColorMap& src, float* dst, size_t maxThreads)
+{
+  size_t w = src.width();
+  const TPPixel* s = src.constData();
+  signedDistances(w, src.height(), maxThreads, [&](size_t x, size_t y){return s[(y*w)+x].r>0;}, dst);
+}
+
+//##################################################################################################
+void signedDistanceField(const tp_image_utils::ByteMap& src, std::vector<float>& dst, size_t maxThreads)
+{
+  dst.resize(src.size());
+  signedDistanceField(src, dst.data(), maxThreads);
+}
+
+//##################################################################################################
+void signedDistanceField(const tp_image_utils::ByteMap& src,
+                         tp_image_utils::ColorMapF& dst,
+                         size_t channel,
+                         size_t maxThreads)
+{
+  if(dst.width() != src.width() || dst.height() != src.height() || channel>3)
+    return;
+
+  size_t w = src.width();
+  const uint8_t* s = src.constData();
+  float* d = reinterpret_cast<float*>(dst.data()) + channel;
+  signedDistances(w, src.height(), maxThreads, [&](size_t x, size_t y){return s[(y*w)+x]>0;}, d, 4);
+}
+
+//##################################################################################################
+tp_image_utils::ByteMap signedDistanceFieldToByteMap(const float* sdf, size_t width, size_t height, int radius)
+{
+  float maxDist = std::sqrt(float(radius*radius));
+  float f = 127.0f / float(radius);
+
+  tp_image_utils::ByteMap dst(width, height);
+  uint8_t* d = dst.data();
+  uint8_t* dMax = d + (width*height);
+  for(; d<dMax; d++, sdf++)
+    (*d) = signedDistanceToByte(*sdf, maxDist, f);
+
+  return dst;
+}
+
+//##################################################################################################
+tp_image_utils::ColorMap signedDistanceFieldToColorMap(const float* sdf, size_t width, size_t height, int radius)
+{
+  float maxDist = std::sqrt(float(radius*radius));
+  float f = 127.0f / float(radius);
+
+  tp_image_utils::ColorMap dst(width, height);
+  TPPixel* d = dst.data();
+  TPPixel* dMax = d + (width*height);
+  for(; d<dMax; d++, sdf++)
+  {
+    uint8_t a = signedDistanceToByte(*sdf, maxDist, f);
+    d->r = a;
+    d->g = a;
+    d->b = a;
+    d->a = 255;
+  }
+
+  return dst;
+}
+
+//##################################################################################################
+std::vector<tp_image_utils::ByteMap> signedDistanceFieldPyramid(const tp_image_utils::ByteMap& src,
+                                                                int radius,
+                                                                size_t levels,
+                                                                size_t maxThreads)
+{
+  std::vector<tp_image_utils::ByteMap> pyramid;
+  pyramid.reserve(levels);
+
+  std::vector<float> sdf;
+  signedDistanceField(src, sdf, maxThreads);
+  signedDistancePyramid(sdf, src.width(), src.height(), radius, levels, [&](const float* data, size_t w, size_t h)
+  {
+    pyramid.push_back(signedDistanceFieldToByteMap(data, w, h, radius));
+  });
+
+  return pyramid;
+}
+
+//##################################################################################################
+std::vector<tp_image_utils::ColorMap> signedDistanceFieldPyramid(const tp_image_utils::ColorMap& src,
+                                                                 int radius,
+                                                                 size_t levels,
+                                                                 size_t maxThreads)
+{
+  std::vector<tp_image_utils::ColorMap> pyramid;
+  pyramid.reserve(levels);
+
+  std::vector<float> sdf(src.size());
+  signedDistanceField(src, sdf.data(), maxThreads);
+  signedDistancePyramid(sdf, src.width(), src.height(), radius, levels, [&](const float* data, size_t w, size_t h)
+  {
+    pyramid.push_back(signedDistanceFieldToColorMap(data, w, h, radius));
+  });
+
+  return pyramid;
+}
+
+//##################################################################################################
+void signedDistanceFieldTiled(size_t width,
+                              size_t height,
+                              int radius,
+                              size_t tileSize,
+                              const std::function<void(size_t, size_t, tp_image_utils::ByteMap&)>& readMask,
+                              const std::function<void(size_t, size_t, const tp_image_utils::ByteMap&)>& writeTile,
+                              size_t maxThreads)
+{
+  if(width<1 || height<1 || tileSize<1)
+    return;
+
+  auto r = size_t(tpMax(0, radius));
+
+  for(size_t ty=0; ty<height; ty+=tileSize)
+  {
+    size_t th  = tpMin(tileSize, height-ty);
+    size_t wy0 = (ty>r)?(ty-r):0;
+    size_t wy1 = tpMin(height, ty+th+r);
+
+    for(size_t tx=0; tx<width; tx+=tileSize)
+    {
+      size_t tw  = tpMin(tileSize, width-tx);
+      size_t wx0 = (tx>r)?(tx-r):0;
+      size_t wx1 = tpMin(width, tx+tw+r);
+
+      tp_image_utils::ByteMap window(wx1-wx0, wy1-wy0);
+      readMask(wx0, wy0, window);
+
+      writeTile(tx, ty, distanceFieldRegion(window, radius, true, maxThreads, tx-wx0, ty-wy0, tw, th));
+    }
+  }
+}
+
+//##################################################################################################
+void signedDistanceFieldTiled(const tp_image_utils::ByteMap& src,
+                              int radius,
+                              size_t tileSize,
+                              const std::function<void(size_t, size_t, const tp_image_utils::ByteMap&)>& writeTile,
+                              size_t maxThreads)
+{
+  size_t w = src.width();
+  signedDistanceFieldTiled(w, src.height(), radius, tileSize, [&](size_t x, size_t y, tp_image_utils::ByteMap& region)
+  {
+    size_t rw = region.width();
+    for(size_t ry=0; ry<region.height(); ry++)
+      std::memcpy(region.data()+(ry*rw), src.constData()+((ry+y)*w)+x, rw);
+  }, writeTile, maxThreads);
+}
+
+//##################################################################################################
+IncrementalDistanceField::IncrementalDistanceField(const tp_image_utils::ByteMap& mask,
+                                                   int radius,
+                                                   bool signedField,
+                                                   size_t maxThreads):
+  m_radius(radius),
+  m_signedField(signedField),
+  m_maxThreads(maxThreads)
+{
+  if(m_signedField)
+    m_field = signedDistanceField(mask, m_radius, DistanceFieldMethod::EDT, m_maxThreads);
+  else
+    m_field = distanceField(mask, m_radius, DistanceFieldMethod::EDT, m_maxThreads);
+}
+
+//##################################################################################################
+const tp_image_utils::ByteMap& IncrementalDistanceField::field()const
+{
+  return m_field;
+}
+
+//##################################################################################################
+void IncrementalDistanceField::update(const tp_image_utils::ByteMap& mask,
+                                      size_t x,
+                                      size_t y,
+                                      size_t width,
+                                      size_t height)
+{
+  size_t w = m_field.width();
+  size_t h = m_field.height();
+
+  if(mask.width() != w || mask.height() != h || width<1 || height<1 || x>=w || y>=h)
+    return;
+
+  auto r = size_t(tpMax(0, m_radius));
+
+  //The pixels that may have changed.
+  size_t rx0 = (x>r)?(x-r):0;
+  size_t ry0 = (y>r)?(y-r):0;
+  size_t rx1 = tpMin(w, x+width+r);
+  size_t ry1 = tpMin(h, y+height+r);
+
+  //The pixels that may effect the pixels that may have changed.
+  size_t wx0 = (rx0>r)?(rx0-r):0;
+  size_t wy0 = (ry0>r)?(ry0-r):0;
+  size_t wx1 = tpMin(w, rx1+r);
+  size_t wy1 = tpMin(h, ry1+r);
+
+  size_t ww = wx1-wx0;
+  size_t wh = wy1-wy0;
+
+  tp_image_utils::ByteMap window(ww, wh);
+  for(size_t wy=0; wy<wh; wy++)
+    std::memcpy(window.data()+(wy*ww), mask.constData()+((wy+wy0)*w)+wx0, ww);
+
+  size_t rw = rx1-rx0;
+  size_t rh = ry1-ry0;
+  tp_image_utils::ByteMap region = distanceFieldRegion(window, m_radius, m_signedField, m_maxThreads, rx0-wx0, ry0-wy0, rw, rh);
+
+  for(size_t ry=0; ry<rh; ry++)
+    std::memcpy(m_field.data()+((ry+ry0)*w)+rx0, region.constData()+(ry*rw), rw);
+}
+
+//##################################################################################################
+void IncrementalDistanceField::update(const tp_image_utils::ByteMap& mask,
+                                      const std::vector<std::pair<size_t, size_t>>& changedPixels)
+{
+  if(changedPixels.empty())
+    return;
+
+  size_t minX = changedPixels.front().first;
+  size_t minY = changedPixels.front().second;
+  size_t maxX = minX;
+  size_t maxY = minY;
+
+  for(const auto& p : changedPixels)
+  {
+    minX = tpMin(minX, p.first );
+    minY = tpMin(minY, p.second);
+    maxX = tpMax(maxX, p.first );
+    maxY = tpMax(maxY, p.second);
+  }
+
+  update(mask, minX, minY, (maxX-minX)+1, (maxY-minY)+1);
+}
+
 }
@@ -6,6 +6,8 @@ DEFINES += tp_image_utils_FUNCTIONS_LIBRARY
 #SOURCES += src/Globals.cpp
 HEADERS += inc/tp_image_utils_functions/Globals.h
 
+HEADERS += src/PrivateUtils.h
+
 
 SOURCES += src/EdgeDetect.cpp
 HEADERS += inc/tp_image_utils_functions/EdgeDetect.h
@@ -16,6 +18,12 @@ HEADERS += inc/tp_image_utils_functions/SignedDistanceField.h
 SOURCES += src/DeNoise.cpp
 HEADERS += inc/tp_image_utils_functions/DeNoise.h
 
+SOURCES += src/RunLengthMask.cpp
+HEADERS += inc/tp_image_utils_functions/RunLengthMask.h
+
+SOURCES += src/ComponentTree.cpp
+HEADERS += inc/tp_image_utils_functions/ComponentTree.h
+
 SOURCES += src/NoiseField.cpp
 HEADERS += inc/tp_image_utils_functions/NoiseField.h
 